@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include "block_allocator.h"
+
+// Linked-structure traversal benchmark. A pool is filled and then half of
+// it is freed at random to model a long running, fragmented pool. Many
+// connections then grow linked lists in interleaved order, either with
+// first-fit BLOCK_ALLOC or with BLOCK_ALLOC_NEAR on the list tail. Each
+// list is then walked repeatedly; the report shows the walk cost and the
+// number of distinct pages a single list touches.
+//
+// Usage: bench_alloc_near [block_size]   (default 256)
+
+#define POOL_BLOCKS (1 << 16)
+#define LISTS 1024
+#define NODES_PER_LIST 16
+#define PASSES 50
+
+typedef struct Node {
+    struct Node* next;
+    uint64_t value;
+} Node;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int compare_pages(const void* a, const void* b) {
+    uintptr_t pa = *(const uintptr_t*)a;
+    uintptr_t pb = *(const uintptr_t*)b;
+    return pa < pb ? -1 : pa > pb;
+}
+
+static void run(size_t block_size, int near) {
+    BlockAllocator* alloc = init_allocator(block_size, block_size * POOL_BLOCKS);
+    void** filler = malloc(sizeof(void*) * POOL_BLOCKS);
+    Node** heads = malloc(sizeof(Node*) * LISTS);
+    Node** tails = malloc(sizeof(Node*) * LISTS);
+    if (!alloc || !filler || !heads || !tails) {
+        printf("Failed to initialize\n");
+        exit(1);
+    }
+    size_t i, n;
+
+    // Fragment the pool: fill it, then free a random half
+    srand(7);
+    for (i = 0; i < POOL_BLOCKS; i++) filler[i] = BLOCK_ALLOC(alloc);
+    for (i = 0; i < POOL_BLOCKS; i++) {
+        if (rand() & 1) {
+            BLOCK_FREE(alloc, filler[i]);
+            filler[i] = NULL;
+        }
+    }
+
+    // Each list starts next to a random surviving object (its connection)
+    for (i = 0; i < LISTS; i++) {
+        void* owner = NULL;
+        while (near && !owner) owner = filler[(size_t)rand() % POOL_BLOCKS];
+        Node* node = near ? BLOCK_ALLOC_NEAR(alloc, owner) : BLOCK_ALLOC(alloc);
+        node->next = NULL;
+        node->value = i;
+        heads[i] = tails[i] = node;
+    }
+    // Grow the lists round-robin, as concurrent connections would
+    for (n = 1; n < NODES_PER_LIST; n++) {
+        for (i = 0; i < LISTS; i++) {
+            Node* node = near ? BLOCK_ALLOC_NEAR(alloc, tails[i]) : BLOCK_ALLOC(alloc);
+            if (!node) {
+                printf("Pool exhausted\n");
+                exit(1);
+            }
+            node->next = NULL;
+            node->value = i + n;
+            tails[i]->next = node;
+            tails[i] = node;
+        }
+    }
+
+    // Distinct pages per list
+    uintptr_t pages[NODES_PER_LIST];
+    size_t total_pages = 0;
+    for (i = 0; i < LISTS; i++) {
+        Node* node;
+        size_t count = 0;
+        for (node = heads[i]; node; node = node->next) pages[count++] = (uintptr_t)node / BLOCK_PAGE_SIZE;
+        qsort(pages, count, sizeof(uintptr_t), compare_pages);
+        size_t distinct = 1;
+        for (n = 1; n < count; n++) distinct += pages[n] != pages[n - 1];
+        total_pages += distinct;
+    }
+
+    // Walk every list, visiting the lists in a scattered order
+    uint64_t sum = 0;
+    double start = now_seconds();
+    size_t pass;
+    for (pass = 0; pass < PASSES; pass++) {
+        for (i = 0; i < LISTS; i++) {
+            Node* node;
+            for (node = heads[(i * 613) % LISTS]; node; node = node->next) sum += node->value;
+        }
+    }
+    double elapsed = now_seconds() - start;
+
+    printf("%-10s %12.2f %14.2f   (checksum %llu)\n", near ? "near" : "first-fit",
+           elapsed * 1e9 / (double)(PASSES * LISTS * NODES_PER_LIST),
+           (double)total_pages / LISTS, (unsigned long long)sum);
+
+    for (i = 0; i < LISTS; i++) {
+        Node* node = heads[i];
+        while (node) {
+            Node* next = node->next;
+            BLOCK_FREE(alloc, node);
+            node = next;
+        }
+    }
+    for (i = 0; i < POOL_BLOCKS; i++) BLOCK_FREE(alloc, filler[i]);
+    free(filler);
+    free(heads);
+    free(tails);
+    free_allocator(alloc);
+}
+
+int main(int argc, char** argv) {
+    size_t block_size = argc > 1 ? strtoul(argv[1], NULL, 0) : 256;
+    printf("block_size=%zu pool=%d blocks, %d lists x %d nodes\n",
+           block_size, POOL_BLOCKS, LISTS, NODES_PER_LIST);
+    printf("%-10s %12s %14s\n", "placement", "ns/node", "pages/list");
+    run(block_size, 0);
+    run(block_size, 1);
+    return 0;
+}
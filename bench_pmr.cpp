@@ -0,0 +1,105 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <list>
+#include <map>
+#include <memory_resource>
+#include <unordered_map>
+#include <vector>
+#include "block_allocator.hpp"
+
+// Node container benchmark: std::allocator against BlockMemoryResource
+// (through std::pmr containers) and BlockStlAllocator. Each run builds a
+// container of N elements, walks it and destroys it.
+//
+// Usage: bench_pmr [elements]   (default 1000000)
+
+using block_allocator::BlockMemoryResource;
+using block_allocator::BlockStlAllocator;
+using block_allocator::probe_node_size;
+
+template <class Fn>
+static double time_ms(Fn fn) {
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+static long checksum;
+
+template <class List>
+static void run_list(List& list, int n) {
+    for (int i = 0; i < n; i++) list.push_back(i);
+    long sum = 0;
+    for (int v : list) sum += v;
+    checksum += sum;
+    list.clear();
+}
+
+template <class Map>
+static void run_map(Map& map, const std::vector<int>& keys) {
+    for (int k : keys) map.emplace(k, k);
+    long sum = 0;
+    for (int k : keys) sum += map.find(k)->second;
+    checksum += sum;
+    map.clear();
+}
+
+static void report(const char* name, double std_ms, double pmr_ms, double stl_ms) {
+    printf("%-14s %12.1f %12.1f %12.1f %9.2fx\n", name, std_ms, pmr_ms, stl_ms, std_ms / pmr_ms);
+}
+
+int main(int argc, char** argv) {
+    int n = argc > 1 ? atoi(argv[1]) : 1000000;
+    std::vector<int> keys(n);
+    for (int i = 0; i < n; i++) keys[i] = i;
+    srand(1);
+    for (int i = n - 1; i > 0; i--) std::swap(keys[i], keys[rand() % (i + 1)]);
+
+    std::size_t list_node = probe_node_size<std::pmr::list<int>>([](auto& l, int i) { l.push_back(i); });
+    std::size_t map_node = probe_node_size<std::pmr::map<int, int>>([](auto& m, int i) { m.emplace(i, i); });
+    std::size_t hash_node = probe_node_size<std::pmr::unordered_map<int, int>>(
+        [](auto& m, int i) { m.emplace(i, i); });
+    printf("elements=%d node sizes: list=%zu map=%zu unordered_map=%zu\n", n, list_node, map_node, hash_node);
+    printf("%-14s %12s %12s %12s %10s\n", "container", "std ms", "pmr ms", "stl ms", "std/pmr");
+
+    {
+        double std_ms = time_ms([&] { std::list<int> l; run_list(l, n); });
+        BlockMemoryResource pmr_res(list_node, n);
+        double pmr_ms = time_ms([&] { std::pmr::list<int> l(&pmr_res); run_list(l, n); });
+        BlockMemoryResource stl_res(list_node, n);
+        double stl_ms = time_ms([&] {
+            std::list<int, BlockStlAllocator<int>> l{BlockStlAllocator<int>(&stl_res)};
+            run_list(l, n);
+        });
+        report("list", std_ms, pmr_ms, stl_ms);
+    }
+    {
+        double std_ms = time_ms([&] { std::map<int, int> m; run_map(m, keys); });
+        BlockMemoryResource pmr_res(map_node, n);
+        double pmr_ms = time_ms([&] { std::pmr::map<int, int> m(&pmr_res); run_map(m, keys); });
+        BlockMemoryResource stl_res(map_node, n);
+        double stl_ms = time_ms([&] {
+            using Alloc = BlockStlAllocator<std::pair<const int, int>>;
+            std::map<int, int, std::less<int>, Alloc> m{Alloc(&stl_res)};
+            run_map(m, keys);
+        });
+        report("map", std_ms, pmr_ms, stl_ms);
+    }
+    {
+        double std_ms = time_ms([&] { std::unordered_map<int, int> m; run_map(m, keys); });
+        BlockMemoryResource pmr_res(hash_node, n);
+        double pmr_ms = time_ms([&] { std::pmr::unordered_map<int, int> m(&pmr_res); run_map(m, keys); });
+        BlockMemoryResource stl_res(hash_node, n);
+        double stl_ms = time_ms([&] {
+            using Alloc = BlockStlAllocator<std::pair<const int, int>>;
+            std::unordered_map<int, int, std::hash<int>, std::equal_to<int>, Alloc> m{
+                0, std::hash<int>(), std::equal_to<int>(), Alloc(&stl_res)};
+            run_map(m, keys);
+        });
+        report("unordered_map", std_ms, pmr_ms, stl_ms);
+    }
+    printf("checksum=%ld\n", checksum);
+    return 0;
+}
@@ -1,7 +1,13 @@
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "block_allocator.h"
 #include "proxy_assert.h"
@@ -18,15 +24,14 @@
 uint32_t pre_stomp_pattern_array[] = {0xDECAFBADu, 0x5A5A5A5Au};
 uint32_t post_stomp_pattern_array[] = {0xDEADFADEu, 0xC5C5C5C5u};
 
-// Initialize the allocator
-// Note: If ENABLE_DEBUG_HEADER is defined, the total_size of the allocation
-// will exceed the requested total_size to ensure there exists the usable
-// space of block_size * total_size in bytes.
-BlockAllocator* init_allocator(size_t block_size, size_t total_size) {
-    BlockAllocator* alloc = malloc(sizeof(BlockAllocator));
-    if (!alloc) return NULL;
-    ASSERT(block_size > 0);
-    ASSERT(total_size >= block_size);
+// Compute the block layout for the compile-time configuration and reset
+// every optional feature to its disabled state.
+// With colored set, a block stride that is a power of two larger than a
+// cache line is padded by one cache line. Otherwise every block would start
+// at the same cache-set offset and the first bytes of each block would
+// compete for a few sets; padded, consecutive blocks land in consecutive
+// sets. Pointers still map to indices with a single division.
+static void init_layout(BlockAllocator* alloc, size_t block_size, size_t total_size, int colored) {
     alloc->block_data_size = block_size;
 
     alloc->total_blocks = total_size / block_size;
@@ -41,9 +46,38 @@ BlockAllocator* init_allocator(size_t block_size, size_t total_size) {
     alloc->data_offset += PRE_BUFFER_STOMP_GUARD_SIZE;
 #endif
 
+    if (colored && block_size > BLOCK_CACHE_LINE_SIZE && (block_size & (block_size - 1)) == 0) {
+        block_size += BLOCK_CACHE_LINE_SIZE;
+    }
+
     alloc->block_size = block_size;
     alloc->total_size = alloc->total_blocks * alloc->block_size;
 
+    alloc->profiler = NULL;
+    alloc->trace = NULL;
+    alloc->ctor = NULL;
+    alloc->dtor = NULL;
+    alloc->constructed = NULL;
+    alloc->shm_base = NULL;
+    alloc->shm_size = 0;
+    alloc->scope_log = NULL;
+    alloc->scope_log_len = 0;
+    alloc->scope_log_cap = 0;
+    alloc->scope_depth = 0;
+    alloc->scanned_bytes = 0;
+    alloc->compact_low = 0;
+    alloc->compact_high = alloc->total_blocks;
+}
+
+// Heap pool construction shared by the init_*_allocator entry points.
+static BlockAllocator* create_allocator(size_t block_size, size_t total_size,
+                                        BlockCtor ctor, BlockDtor dtor, int colored) {
+    BlockAllocator* alloc = malloc(sizeof(BlockAllocator));
+    if (!alloc) return NULL;
+    ASSERT(block_size > 0);
+    ASSERT(total_size >= block_size);
+    init_layout(alloc, block_size, total_size, colored);
+
     alloc->memory = malloc(alloc->total_size);
     alloc->bitmap = malloc((alloc->total_blocks + 7) / 8); // One bit per block, rounded up
     if (!alloc->memory || !alloc->bitmap) {
@@ -54,9 +88,251 @@ BlockAllocator* init_allocator(size_t block_size, size_t total_size) {
     }
 
     memset(alloc->bitmap, 0, (alloc->total_blocks + 7) / 8); // All blocks free
+
+    alloc->ctor = ctor;
+    alloc->dtor = dtor;
+    if (ctor || dtor) {
+        alloc->constructed = malloc((alloc->total_blocks + 7) / 8);
+        if (!alloc->constructed) {
+            free(alloc->memory);
+            free(alloc->bitmap);
+            free(alloc);
+            return NULL;
+        }
+        memset(alloc->constructed, 0, (alloc->total_blocks + 7) / 8); // Nothing constructed yet
+    }
+    return alloc;
+}
+
+// Initialize the allocator
+// Note: If ENABLE_DEBUG_HEADER is defined, the total_size of the allocation
+// will exceed the requested total_size to ensure there exists the usable
+// space of block_size * total_size in bytes.
+BlockAllocator* init_allocator(size_t block_size, size_t total_size) {
+    return create_allocator(block_size, total_size, NULL, NULL, 0);
+}
+
+// Initialize an allocator with cache-colored block placement. See
+// init_layout for when the stride is padded.
+BlockAllocator* init_colored_allocator(size_t block_size, size_t total_size) {
+    return create_allocator(block_size, total_size, NULL, NULL, 1);
+}
+
+// Initialize an object caching allocator. ctor runs once, the first time a
+// block is handed out, and freed blocks keep their constructed state so the
+// next alloc of that block skips construction. dtor runs only when the memory
+// is reclaimed, either by reclaim_free_blocks or by free_allocator.
+BlockAllocator* init_object_allocator(size_t block_size, size_t total_size,
+                                      BlockCtor ctor, BlockDtor dtor) {
+    return create_allocator(block_size, total_size, ctor, dtor, 0);
+}
+
+// Open an allocation scope. Every block allocated from here on is logged
+// until the scope is closed by alloc_rollback or alloc_commit. Scopes nest
+// and must be closed innermost first. Shared pools don't support scopes: a
+// logged slot may be freed and reclaimed by another process, so no scope is
+// opened and ALLOC_MARK_NONE is returned.
+AllocMark alloc_mark(BlockAllocator* alloc) {
+    if (!alloc) return ALLOC_MARK_NONE;
+    ASSERT(!alloc->shm_base);
+    if (alloc->shm_base) return ALLOC_MARK_NONE;
+    alloc->scope_depth++;
+    return alloc->scope_log_len;
+}
+
+// Close the scope opened by mark, freeing every block allocated since then
+// that is still live. Cost is proportional to the allocations made since
+// the mark, not to the pool size.
+void alloc_rollback(BlockAllocator* alloc, AllocMark mark) {
+    if (!alloc || mark == ALLOC_MARK_NONE) return;
+    ASSERT(alloc->scope_depth > 0 && mark <= alloc->scope_log_len);
+    if (alloc->shm_base || alloc->scope_depth == 0 || mark > alloc->scope_log_len) return;
+
+    size_t i = alloc->scope_log_len;
+    while (i > mark) {
+        size_t index = alloc->scope_log[--i];
+        // The client may have freed it already, or freed and reused the slot,
+        // in which case a later log entry covers it.
+        if (test_bit(alloc->bitmap, index)) {
+            free_block(alloc, alloc->memory + (index * alloc->block_size) + alloc->data_offset);
+        }
+    }
+    alloc->scope_log_len = mark;
+    alloc_commit(alloc, mark);
+}
+
+// Close the scope opened by mark, keeping its blocks. They are handed to
+// the enclosing scope, if any.
+void alloc_commit(BlockAllocator* alloc, AllocMark mark) {
+    if (!alloc || mark == ALLOC_MARK_NONE) return;
+    ASSERT(alloc->scope_depth > 0 && mark <= alloc->scope_log_len);
+    if (alloc->shm_base || alloc->scope_depth == 0) return;
+    alloc->scope_depth--;
+    if (alloc->scope_depth == 0) {
+        alloc->scope_log_len = 0; // Nothing left to roll back to
+    }
+}
+
+// Shared-memory pools. The segment holds a SharedPoolHeader, then the bitmap,
+// then the blocks, each section starting on a cache line. Every process maps
+// it at its own address, so blocks are exchanged as offsets from memory.
+#define SHARED_POOL_MAGIC 0x4C4F4F50u // "POOL"
+#define SHARED_POOL_VERSION 1
+#define SHARED_POOL_ALIGN 64
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t block_size;
+    uint64_t block_data_size;
+    uint64_t data_offset;
+    uint64_t total_blocks;
+    uint64_t bitmap_offset;
+    uint64_t memory_offset;
+    uint32_t ready;         // Published last, once the rest is initialized
+} SharedPoolHeader;
+
+static size_t align_up(size_t value, size_t align) {
+    return (value + align - 1) & ~(align - 1);
+}
+
+static BlockAllocator* map_shared_pool(int fd, size_t size) {
+    BlockAllocator* alloc = malloc(sizeof(BlockAllocator));
+    if (!alloc) return NULL;
+    void* base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        free(alloc);
+        return NULL;
+    }
+    alloc->shm_base = base;
+    alloc->shm_size = size;
     return alloc;
 }
 
+// Create a named shared-memory pool that other processes can attach to with
+// attach_shared_allocator. Fails if a pool with that name already exists.
+// The name follows shm_open rules, e.g. "/my_pool".
+BlockAllocator* create_shared_allocator(const char* name, size_t block_size, size_t total_size) {
+    if (!name) return NULL;
+    ASSERT(block_size > 0);
+    ASSERT(total_size >= block_size);
+
+    BlockAllocator layout;
+    init_layout(&layout, block_size, total_size, 0);
+    size_t bitmap_offset = align_up(sizeof(SharedPoolHeader), SHARED_POOL_ALIGN);
+    size_t memory_offset = align_up(bitmap_offset + (layout.total_blocks + 7) / 8, SHARED_POOL_ALIGN);
+    size_t size = memory_offset + layout.total_size;
+
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) return NULL;
+    // ftruncate zero fills, so every block starts out free
+    BlockAllocator* alloc = NULL;
+    if (ftruncate(fd, (off_t)size) == 0) {
+        alloc = map_shared_pool(fd, size);
+    }
+    close(fd);
+    if (!alloc) {
+        shm_unlink(name);
+        return NULL;
+    }
+
+    void* base = alloc->shm_base;
+    *alloc = layout;
+    alloc->shm_base = base;
+    alloc->shm_size = size;
+    alloc->bitmap = (uint8_t*)base + bitmap_offset;
+    alloc->memory = (uint8_t*)base + memory_offset;
+
+    SharedPoolHeader* header = base;
+    header->magic = SHARED_POOL_MAGIC;
+    header->version = SHARED_POOL_VERSION;
+    header->block_size = alloc->block_size;
+    header->block_data_size = alloc->block_data_size;
+    header->data_offset = alloc->data_offset;
+    header->total_blocks = alloc->total_blocks;
+    header->bitmap_offset = bitmap_offset;
+    header->memory_offset = memory_offset;
+    __atomic_store_n(&header->ready, 1, __ATOMIC_RELEASE);
+    return alloc;
+}
+
+// Attach to a pool made by create_shared_allocator. The attaching process
+// must be built with the same ENABLE_DEBUG_HEADER and ENABLE_STOMP_DETECT
+// settings as the creator. Release with free_allocator, which unmaps the
+// pool but leaves it in place for other processes.
+BlockAllocator* attach_shared_allocator(const char* name) {
+    if (!name) return NULL;
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) return NULL;
+    struct stat st;
+    BlockAllocator* alloc = NULL;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(SharedPoolHeader)) {
+        alloc = map_shared_pool(fd, (size_t)st.st_size);
+    }
+    close(fd);
+    if (!alloc) return NULL;
+
+    void* base = alloc->shm_base;
+    size_t size = alloc->shm_size;
+    SharedPoolHeader* header = base;
+    if (header->magic != SHARED_POOL_MAGIC || header->version != SHARED_POOL_VERSION ||
+            !__atomic_load_n(&header->ready, __ATOMIC_ACQUIRE)) {
+        munmap(base, size);
+        free(alloc);
+        return NULL;
+    }
+
+    // The header comes from another process, check it before deriving a layout
+    if (header->block_data_size == 0 || header->total_blocks == 0 ||
+            header->total_blocks > size / header->block_data_size ||
+            header->bitmap_offset < sizeof(SharedPoolHeader) ||
+            header->memory_offset > size ||
+            header->bitmap_offset > header->memory_offset ||
+            (header->total_blocks + 7) / 8 > header->memory_offset - header->bitmap_offset) {
+        munmap(base, size);
+        free(alloc);
+        return NULL;
+    }
+
+    init_layout(alloc, header->block_data_size, header->block_data_size * header->total_blocks, 0);
+    if (alloc->block_size != header->block_size || alloc->data_offset != header->data_offset ||
+            alloc->total_size > size - header->memory_offset) {
+        munmap(base, size); // Built with a different debug configuration
+        free(alloc);
+        return NULL;
+    }
+    alloc->shm_base = base;
+    alloc->shm_size = size;
+    alloc->bitmap = (uint8_t*)base + header->bitmap_offset;
+    alloc->memory = (uint8_t*)base + header->memory_offset;
+    return alloc;
+}
+
+// Remove the pool name. Processes already attached keep their mapping.
+int unlink_shared_allocator(const char* name) {
+    if (!name) return -1;
+    return shm_unlink(name);
+}
+
+// Convert a client pointer to an offset that is valid in every process
+// attached to the same pool. Returns BLOCK_OFFSET_NONE for foreign pointers.
+size_t block_to_offset(BlockAllocator* alloc, void* ptr) {
+    if (!alloc || !ptr) return BLOCK_OFFSET_NONE;
+    if ((uint8_t*)ptr < alloc->memory + alloc->data_offset) return BLOCK_OFFSET_NONE;
+    size_t offset = (uint8_t*)ptr - alloc->memory;
+    if (offset >= alloc->total_size) return BLOCK_OFFSET_NONE;
+    if ((offset - alloc->data_offset) % alloc->block_size != 0) return BLOCK_OFFSET_NONE;
+    return offset;
+}
+
+// Convert an offset from block_to_offset back to a client pointer.
+void* offset_to_block(BlockAllocator* alloc, size_t offset) {
+    if (!alloc || offset == BLOCK_OFFSET_NONE) return NULL;
+    if (offset < alloc->data_offset || offset >= alloc->total_size) return NULL;
+    if ((offset - alloc->data_offset) % alloc->block_size != 0) return NULL;
+    return alloc->memory + offset;
+}
+
 #if ENABLE_STOMP_DETECT
 void check_block_for_stomp(BlockAllocator* alloc, void* ptr) {
     uint32_t* pre_ptr = (uint32_t *)((uint8_t*)ptr - PRE_BUFFER_STOMP_GUARD_SIZE);
@@ -94,14 +370,401 @@ void check_for_stomps(BlockAllocator* alloc) {
 #endif
 }
 
+#if ENABLE_DEBUG_HEADER
+// Per-callsite profiler: an open addressing hash table keyed by the
+// file/line pair recorded in the DebugHeader.
+typedef struct {
+    const char* file;       // NULL marks an empty slot
+    uint32_t line;
+    uint32_t hash;
+    size_t live_blocks;
+    size_t total_allocs;
+    size_t snapshot_allocs; // total_allocs when profiler_top_rate last reported
+} CallsiteEntry;
+
+struct CallsiteProfiler {
+    CallsiteEntry* table;
+    size_t capacity;        // Always a power of two
+    size_t count;
+    uint32_t sample_period; // Record one allocation out of every sample_period
+    uint32_t countdown;
+    uint32_t tag;           // Stamped in DebugHeader.profile_tag of sampled blocks
+    struct timespec start;
+    struct timespec snapshot; // When profiler_top_rate last reported
+};
+
+#define PROFILER_INITIAL_CAPACITY 64
+
+static uint32_t next_profile_tag = 1;
+
+// FNV-1a over the file name and line. Hashing the string rather than the
+// pointer merges callsites whose __FILE__ literals were not pooled.
+static uint32_t callsite_hash(const char* file, uint32_t line) {
+    uint32_t hash = 2166136261u;
+    const char* c;
+    for (c = file; *c; c++) {
+        hash = (hash ^ (uint8_t)*c) * 16777619u;
+    }
+    hash = (hash ^ line) * 16777619u;
+    return hash;
+}
+
+static CallsiteEntry* find_callsite(struct CallsiteProfiler* prof, const char* file,
+                                    uint32_t line, uint32_t hash) {
+    size_t mask = prof->capacity - 1;
+    size_t slot = hash & mask;
+    while (prof->table[slot].file) {
+        CallsiteEntry* entry = &prof->table[slot];
+        if (entry->hash == hash && entry->line == line &&
+                (entry->file == file || strcmp(entry->file, file) == 0)) {
+            return entry;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return &prof->table[slot]; // Empty slot where the callsite belongs
+}
+
+static int grow_profiler(struct CallsiteProfiler* prof) {
+    size_t capacity = prof->capacity * 2;
+    CallsiteEntry* table = malloc(capacity * sizeof(CallsiteEntry));
+    if (!table) return -1;
+    memset(table, 0, capacity * sizeof(CallsiteEntry));
+
+    CallsiteEntry* old = prof->table;
+    size_t old_capacity = prof->capacity;
+    prof->table = table;
+    prof->capacity = capacity;
+    size_t i;
+    for (i = 0; i < old_capacity; i++) {
+        if (old[i].file) {
+            *find_callsite(prof, old[i].file, old[i].line, old[i].hash) = old[i];
+        }
+    }
+    free(old);
+    return 0;
+}
+
+// Enable the callsite profiler. One out of every sample_period allocations
+// is recorded (0 or 1 records all of them). Blocks allocated before the
+// profiler was enabled are not counted. Not available on shared pools.
+// Returns 0 on success, -1 on failure.
+int enable_profiler(BlockAllocator* alloc, uint32_t sample_period) {
+    // DebugHeader file names are not valid in other processes
+    if (!alloc || alloc->shm_base) return -1;
+    disable_profiler(alloc);
+
+    struct CallsiteProfiler* prof = malloc(sizeof(struct CallsiteProfiler));
+    if (!prof) return -1;
+    prof->capacity = PROFILER_INITIAL_CAPACITY;
+    prof->table = malloc(prof->capacity * sizeof(CallsiteEntry));
+    if (!prof->table) {
+        free(prof);
+        return -1;
+    }
+    memset(prof->table, 0, prof->capacity * sizeof(CallsiteEntry));
+    prof->count = 0;
+    prof->sample_period = sample_period ? sample_period : 1;
+    prof->countdown = 1;
+    prof->tag = next_profile_tag++;
+    if (next_profile_tag == 0) next_profile_tag = 1;
+    clock_gettime(CLOCK_MONOTONIC, &prof->start);
+    prof->snapshot = prof->start;
+    alloc->profiler = prof;
+    return 0;
+}
+
+void disable_profiler(BlockAllocator* alloc) {
+    if (!alloc || !alloc->profiler) return;
+    free(alloc->profiler->table);
+    free(alloc->profiler);
+    alloc->profiler = NULL;
+}
+
+static void profile_alloc(struct CallsiteProfiler* prof, DebugHeader* header) {
+    if (--prof->countdown != 0) return;
+    prof->countdown = prof->sample_period;
+    if (!header->file) return;
+
+    uint32_t hash = callsite_hash(header->file, header->line);
+    CallsiteEntry* entry = find_callsite(prof, header->file, header->line, hash);
+    if (!entry->file) {
+        // Keep the load factor under one half
+        if ((prof->count + 1) * 2 > prof->capacity) {
+            if (grow_profiler(prof) != 0) return; // Drop the sample
+            entry = find_callsite(prof, header->file, header->line, hash);
+        }
+        entry->file = header->file;
+        entry->line = header->line;
+        entry->hash = hash;
+        prof->count++;
+    }
+    entry->live_blocks++;
+    entry->total_allocs++;
+    header->profile_tag = prof->tag;
+}
+
+static void profile_free(struct CallsiteProfiler* prof, DebugHeader* header) {
+    if (header->profile_tag != prof->tag) return;
+    CallsiteEntry* entry = find_callsite(prof, header->file, header->line,
+                                         callsite_hash(header->file, header->line));
+    if (entry->file && entry->live_blocks > 0) {
+        entry->live_blocks--;
+    }
+    header->profile_tag = 0;
+}
+
+static int compare_live(const void* a, const void* b) {
+    const CallsiteStats* sa = a;
+    const CallsiteStats* sb = b;
+    if (sa->live_blocks != sb->live_blocks) return sa->live_blocks < sb->live_blocks ? 1 : -1;
+    return 0;
+}
+
+static int compare_rate(const void* a, const void* b) {
+    const CallsiteStats* sa = a;
+    const CallsiteStats* sb = b;
+    if (sa->alloc_rate != sb->alloc_rate) return sa->alloc_rate < sb->alloc_rate ? 1 : -1;
+    return 0;
+}
+
+// Copy the n busiest callsites, ordered by compare, into out. Rates cover
+// the window since the last snapshot; a new snapshot is taken if requested.
+static size_t profiler_top(BlockAllocator* alloc, CallsiteStats* out, size_t n,
+                           int (*compare)(const void*, const void*), int snapshot) {
+    if (!alloc || !alloc->profiler || !out || n == 0) return 0;
+    struct CallsiteProfiler* prof = alloc->profiler;
+    if (prof->count == 0) return 0;
+
+    CallsiteStats* all = malloc(prof->count * sizeof(CallsiteStats));
+    if (!all) return 0;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed = (double)(now.tv_sec - prof->snapshot.tv_sec) +
+                     (double)(now.tv_nsec - prof->snapshot.tv_nsec) / 1e9;
+
+    size_t i, count = 0;
+    for (i = 0; i < prof->capacity; i++) {
+        CallsiteEntry* entry = &prof->table[i];
+        if (!entry->file) continue;
+        size_t recent = (entry->total_allocs - entry->snapshot_allocs) * prof->sample_period;
+        all[count].file = entry->file;
+        all[count].line = entry->line;
+        all[count].live_blocks = entry->live_blocks * prof->sample_period;
+        all[count].total_allocs = entry->total_allocs * prof->sample_period;
+        all[count].alloc_rate = elapsed > 0 ? (double)recent / elapsed : 0.0;
+        if (snapshot) entry->snapshot_allocs = entry->total_allocs;
+        count++;
+    }
+    if (snapshot) prof->snapshot = now;
+    qsort(all, count, sizeof(CallsiteStats), compare);
+
+    if (n > count) n = count;
+    memcpy(out, all, n * sizeof(CallsiteStats));
+    free(all);
+    return n;
+}
+
+// Report the top n callsites by live blocks. Returns the number written.
+size_t profiler_top_live(BlockAllocator* alloc, CallsiteStats* out, size_t n) {
+    return profiler_top(alloc, out, n, compare_live, 0);
+}
+
+// Report the top n callsites by allocation rate since the previous
+// profiler_top_rate call (or since the profiler was enabled), then start a
+// new window. Returns the number written.
+size_t profiler_top_rate(BlockAllocator* alloc, CallsiteStats* out, size_t n) {
+    return profiler_top(alloc, out, n, compare_rate, 1);
+}
+#endif
+
+// Allocation tracing. Each thread appends events to its own buffer without
+// locking; the trace lock is only taken to register a thread and to write a
+// full buffer to the file.
+#define TRACE_BUFFER_EVENTS 4096
+
+typedef struct TraceBuffer {
+    struct TraceBuffer* next;
+    pthread_t owner;
+    uint16_t thread;
+    size_t count;
+    TraceEvent events[TRACE_BUFFER_EVENTS];
+} TraceBuffer;
+
+struct AllocTrace {
+    FILE* file;
+    pthread_mutex_t lock;
+    TraceBuffer* buffers;
+    uint16_t next_thread;
+    uint64_t session;       // Distinguishes this trace from freed ones in thread caches
+};
+
+static uint64_t next_trace_session = 1;
+static __thread uint64_t cached_trace_session;
+static __thread TraceBuffer* cached_trace_buffer;
+
+static void flush_trace_buffer(struct AllocTrace* trace, TraceBuffer* buffer) {
+    if (buffer->count) {
+        fwrite(buffer->events, sizeof(TraceEvent), buffer->count, trace->file);
+        buffer->count = 0;
+    }
+}
+
+// Find or register the calling thread's buffer. NULL if out of memory.
+static TraceBuffer* thread_trace_buffer(struct AllocTrace* trace) {
+    if (cached_trace_session == trace->session) return cached_trace_buffer;
+
+    pthread_t self = pthread_self();
+    pthread_mutex_lock(&trace->lock);
+    TraceBuffer* buffer;
+    for (buffer = trace->buffers; buffer; buffer = buffer->next) {
+        if (pthread_equal(buffer->owner, self)) break;
+    }
+    if (!buffer) {
+        buffer = malloc(sizeof(TraceBuffer));
+        if (buffer) {
+            buffer->owner = self;
+            buffer->thread = trace->next_thread++;
+            buffer->count = 0;
+            buffer->next = trace->buffers;
+            trace->buffers = buffer;
+        }
+    }
+    pthread_mutex_unlock(&trace->lock);
+
+    if (buffer) {
+        cached_trace_session = trace->session;
+        cached_trace_buffer = buffer;
+    }
+    return buffer;
+}
+
+static void record_trace_event(struct AllocTrace* trace, size_t index, uint8_t op) {
+    TraceBuffer* buffer = thread_trace_buffer(trace);
+    if (!buffer) return;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    TraceEvent* event = &buffer->events[buffer->count++];
+    event->timestamp_ns = (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+    event->index = (uint32_t)index;
+    event->thread = buffer->thread;
+    event->op = op;
+    event->reserved = 0;
+
+    if (buffer->count == TRACE_BUFFER_EVENTS) {
+        pthread_mutex_lock(&trace->lock);
+        flush_trace_buffer(trace, buffer);
+        pthread_mutex_unlock(&trace->lock);
+    }
+}
+
+// Start writing a binary trace of alloc/free events to path, replacing any
+// trace already running. Returns 0 on success, -1 on failure.
+int start_trace(BlockAllocator* alloc, const char* path) {
+    if (!alloc || !path) return -1;
+    stop_trace(alloc);
+
+    struct AllocTrace* trace = malloc(sizeof(struct AllocTrace));
+    if (!trace) return -1;
+    trace->file = fopen(path, "wb");
+    if (!trace->file) {
+        free(trace);
+        return -1;
+    }
+    TraceFileHeader header = {
+        TRACE_MAGIC, TRACE_VERSION, alloc->block_data_size, alloc->total_blocks
+    };
+    if (fwrite(&header, sizeof(header), 1, trace->file) != 1) {
+        fclose(trace->file);
+        free(trace);
+        return -1;
+    }
+    pthread_mutex_init(&trace->lock, NULL);
+    trace->buffers = NULL;
+    trace->next_thread = 0;
+    trace->session = __atomic_fetch_add(&next_trace_session, 1, __ATOMIC_RELAXED);
+    alloc->trace = trace;
+    return 0;
+}
+
+// Flush every thread's pending events and close the trace file. Other
+// threads must not be using the allocator while the trace is stopped.
+void stop_trace(BlockAllocator* alloc) {
+    if (!alloc || !alloc->trace) return;
+    struct AllocTrace* trace = alloc->trace;
+    alloc->trace = NULL;
+
+    TraceBuffer* buffer = trace->buffers;
+    while (buffer) {
+        TraceBuffer* next = buffer->next;
+        flush_trace_buffer(trace, buffer);
+        free(buffer);
+        buffer = next;
+    }
+    fclose(trace->file);
+    pthread_mutex_destroy(&trace->lock);
+    free(trace);
+}
+
+// Run the destructor on constructed blocks (free ones only, unless
+// include_allocated is set) and forget their constructed state.
+static size_t destroy_blocks(BlockAllocator* alloc, int include_allocated) {
+    size_t destroyed = 0;
+    size_t i;
+    for (i = 0; i < (alloc->total_blocks + 7) / 8; i++) {
+        uint8_t mask = alloc->constructed[i];
+        if (!include_allocated) {
+            mask &= (uint8_t)~alloc->bitmap[i];
+        }
+        if (mask == 0x00) continue;
+        for (size_t j = 0; j < 8 && (i * 8 + j) < alloc->total_blocks; j++) {
+            size_t index = i * 8 + j;
+            if (mask & (1 << j)) {
+                uint8_t* ptr = alloc->memory + (index * alloc->block_size) + alloc->data_offset;
+                if (alloc->dtor) {
+                    alloc->dtor(ptr, alloc->block_data_size);
+                }
+                clear_bit(alloc->constructed, index);
+                destroyed++;
+            }
+        }
+    }
+    return destroyed;
+}
+
+// Destroy the cached objects held by free blocks. Returns the number of
+// blocks destroyed; they will be constructed again when next handed out.
+size_t reclaim_free_blocks(BlockAllocator* alloc) {
+    if (!alloc || !alloc->constructed) return 0;
+    return destroy_blocks(alloc, 0);
+}
+
 // Free the allocator
 void free_allocator(BlockAllocator* alloc) {
     if (alloc) {
 #if ENABLE_STOMP_DETECT
-        check_for_stomps(alloc);
+        // Other processes may have claimed shared blocks without writing
+        // their guards yet, so shared pools are only checked in free_block.
+        if (!alloc->shm_base) {
+            check_for_stomps(alloc);
+        }
 #endif
-        free(alloc->memory);
-        free(alloc->bitmap);
+        if (alloc->constructed) {
+            destroy_blocks(alloc, 1);
+        }
+#if ENABLE_DEBUG_HEADER
+        disable_profiler(alloc);
+#endif
+        stop_trace(alloc);
+        free(alloc->scope_log);
+        if (alloc->shm_base) {
+            munmap(alloc->shm_base, alloc->shm_size);
+        } else {
+            free(alloc->memory);
+            free(alloc->bitmap);
+        }
+        free(alloc->constructed);
         free(alloc);
     }
 }
@@ -119,51 +782,280 @@ int test_bit(uint8_t* bitmap, size_t index) {
     return (bitmap[index / 8] & (1 << (index % 8))) != 0;
 }
 
-// Allocate a block with debug info
-void* alloc_block(BlockAllocator* alloc, const char* file, int line) {
+// Release a block's bit, atomically for shared pools.
+static void release_bit(BlockAllocator* alloc, size_t index) {
+    if (alloc->shm_base) {
+        __atomic_fetch_and(&alloc->bitmap[index / 8], (uint8_t)~(1 << (index % 8)), __ATOMIC_RELEASE);
+    } else {
+        clear_bit(alloc->bitmap, index);
+        if (index < alloc->compact_low) alloc->compact_low = index;
+    }
+}
+
+// Append a block index to the log replayed by alloc_rollback.
+static int record_scope_block(BlockAllocator* alloc, size_t index) {
+    if (alloc->scope_log_len == alloc->scope_log_cap) {
+        size_t cap = alloc->scope_log_cap ? alloc->scope_log_cap * 2 : 64;
+        size_t* log = realloc(alloc->scope_log, cap * sizeof(size_t));
+        if (!log) return -1;
+        alloc->scope_log = log;
+        alloc->scope_log_cap = cap;
+    }
+    alloc->scope_log[alloc->scope_log_len++] = index;
+    return 0;
+}
+
+// Fill in the debug header, stomp guards and object state of a block that
+// was just claimed in the bitmap, and return the client pointer.
+static void* prepare_block(BlockAllocator* alloc, size_t index, const char* file, int line) {
 #if ENABLE_DEBUG_HEADER == 0
     (void)file;
     (void)line;
 #endif
+    // A block that can't be rolled back is not handed out
+    if (alloc->scope_depth && record_scope_block(alloc, index) != 0) {
+        release_bit(alloc, index);
+        return NULL;
+    }
+    if (index >= alloc->compact_high) alloc->compact_high = index + 1;
+    uint8_t* block = alloc->memory + (index * alloc->block_size);
+
+    // Store debug header if enabled
+#if ENABLE_DEBUG_HEADER == 1
+    DebugHeader* header = (DebugHeader*)block;
+    // File name pointers mean nothing to other processes sharing the pool
+    header->file = alloc->shm_base ? NULL : file;
+    header->line = line;
+    header->profile_tag = 0;
+    if (alloc->profiler) {
+        profile_alloc(alloc->profiler, header);
+    }
+    block += sizeof(DebugHeader);
+#endif
+#if ENABLE_STOMP_DETECT
+    uint32_t* pre_ptr = (uint32_t *)block;
+    int k;
+    for(k = 0; k < (int)(PRE_BUFFER_STOMP_GUARD_SIZE / sizeof(uint32_t)); k++) {
+        *pre_ptr++ = pre_stomp_pattern_array[k];
+    }
+    block += PRE_BUFFER_STOMP_GUARD_SIZE;
+
+    uint32_t* post_ptr = (uint32_t*)(block + alloc->block_data_size);
+    for(k = 0; k < (int)(POST_BUFFER_STOMP_GUARD_SIZE / sizeof(uint32_t)); k++) {
+        *post_ptr++ = post_stomp_pattern_array[k];
+    }
+#endif
+    // Construct the object the first time this block is used
+    if (alloc->constructed && !test_bit(alloc->constructed, index)) {
+        if (alloc->ctor) {
+            alloc->ctor(block, alloc->block_data_size);
+        }
+        set_bit(alloc->constructed, index);
+    }
+    if (alloc->trace) {
+        record_trace_event(alloc->trace, index, TRACE_OP_ALLOC);
+    }
+    return (void*)block;
+}
+
+// First-fit scan for shared pools. Bits are claimed with compare-and-swap
+// so several processes can allocate from the same bitmap concurrently.
+static void* alloc_shared_block(BlockAllocator* alloc, const char* file, int line) {
+    size_t i;
+    for (i = 0; i < (alloc->total_blocks + 7) / 8; i++) {
+        alloc->scanned_bytes++;
+        uint8_t byte = __atomic_load_n(&alloc->bitmap[i], __ATOMIC_RELAXED);
+        while (byte != 0xFF) {
+            size_t j = 0;
+            while (byte & (1 << j)) j++;
+            if (i * 8 + j >= alloc->total_blocks) break; // Only padding bits left
+            if (__atomic_compare_exchange_n(&alloc->bitmap[i], &byte, (uint8_t)(byte | (1 << j)),
+                                            0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                return prepare_block(alloc, i * 8 + j, file, line);
+            }
+            // Lost the race, byte now holds the current value
+        }
+    }
+    return NULL; // No free blocks
+}
+
+// Allocate a block with debug info
+void* alloc_block(BlockAllocator* alloc, const char* file, int line) {
     if (!alloc) return NULL;
+    if (alloc->shm_base) return alloc_shared_block(alloc, file, line);
 
     // Scan bitmap for first free block, checking bytes first
     size_t i;
     for (i = 0; i < (alloc->total_blocks + 7) / 8; i++) {
+        alloc->scanned_bytes++;
         if (alloc->bitmap[i] != 0xFF) { // If byte isn't fully allocated
             // Check individual bits in this byte
             for (size_t j = 0; j < 8 && (i * 8 + j) < alloc->total_blocks; j++) {
                 size_t index = i * 8 + j;
                 if (!test_bit(alloc->bitmap, index)) {
                     set_bit(alloc->bitmap, index);
-                    uint8_t* block = alloc->memory + (index * alloc->block_size);
+                    return prepare_block(alloc, index, file, line);
+                }
+            }
+        }
+    }
+    return NULL; // No free blocks
+}
 
-                    // Store debug header if enabled
-#if ENABLE_DEBUG_HEADER == 1
-                    DebugHeader* header = (DebugHeader*)block;
-                    header->file = file;
-                    header->line = line;
-                    block += sizeof(DebugHeader);
-#endif
+#define NO_FREE_BLOCK ((size_t)-1)
+
+// Nearest free block to index within [lo, hi), searching outward one block
+// at a time. Returns NO_FREE_BLOCK if every block in the window is taken.
+static size_t find_free_near(BlockAllocator* alloc, size_t index, size_t lo, size_t hi) {
+    if (hi > alloc->total_blocks) hi = alloc->total_blocks;
+    size_t found = NO_FREE_BLOCK;
+    size_t d;
+    for (d = 0; index >= lo + d || index + d < hi; d++) {
+        if (index >= lo + d && !test_bit(alloc->bitmap, index - d)) {
+            found = index - d;
+            break;
+        }
+        if (index + d < hi && !test_bit(alloc->bitmap, index + d)) {
+            found = index + d;
+            break;
+        }
+    }
+    // Probes stayed within index +/- d, clipped to the window
+    size_t first = index >= lo + d ? index - d : lo;
+    size_t last = index + d < hi ? index + d : hi - 1;
+    alloc->scanned_bytes += last / 8 - first / 8 + 1;
+    return found;
+}
+
+// Nearest free block to index among the bitmap bytes sharing a cache line
+// with index's byte, nearest byte first. In a lower byte the nearest free
+// block is the highest one, in a higher byte the lowest one.
+static size_t find_free_in_bitmap_line(BlockAllocator* alloc, size_t index) {
+    size_t bytes = (alloc->total_blocks + 7) / 8;
+    size_t byte = index / 8;
+    size_t line_lo = byte & ~(size_t)(BLOCK_CACHE_LINE_SIZE - 1);
+    size_t line_hi = line_lo + BLOCK_CACHE_LINE_SIZE < bytes ? line_lo + BLOCK_CACHE_LINE_SIZE : bytes;
+    size_t found;
+    size_t d;
+    for (d = 0; byte >= line_lo + d || byte + d < line_hi; d++) {
+        alloc->scanned_bytes += (byte >= line_lo + d) + (d && byte + d < line_hi);
+        if (byte >= line_lo + d && alloc->bitmap[byte - d] != 0xFF) {
+            size_t start = d ? (byte - d) * 8 + 7 : index;
+            found = find_free_near(alloc, start, (byte - d) * 8, (byte - d) * 8 + 8);
+            if (found != NO_FREE_BLOCK) return found;
+        }
+        if (d && byte + d < line_hi && alloc->bitmap[byte + d] != 0xFF) {
+            found = find_free_near(alloc, (byte + d) * 8, (byte + d) * 8, (byte + d) * 8 + 8);
+            if (found != NO_FREE_BLOCK) return found;
+        }
+    }
+    return NO_FREE_BLOCK;
+}
+
+// Allocate a block as close as possible to hint, a pointer previously
+// returned by this allocator. The search first stays within the memory page
+// holding the hint, then within the cache line of bitmap covering it, and
+// finally falls back to the first fit of alloc_block. Keeping related
+// objects together means traversals touch fewer pages and TLB entries.
+void* alloc_block_near(BlockAllocator* alloc, void* hint, const char* file, int line) {
+    if (!alloc) return NULL;
+    // Shared pools only claim bits atomically in first-fit order
+    if (alloc->shm_base || !hint || (uint8_t*)hint < alloc->memory + alloc->data_offset ||
+            (uint8_t*)hint >= alloc->memory + alloc->total_size) {
+        return alloc_block(alloc, file, line);
+    }
+    size_t index = ((uint8_t*)hint - alloc->memory - alloc->data_offset) / alloc->block_size;
+
+    // Blocks overlapping the page that holds the start of the hint block
+    uintptr_t base = (uintptr_t)alloc->memory;
+    uintptr_t page = (base + index * alloc->block_size) & ~(uintptr_t)(BLOCK_PAGE_SIZE - 1);
+    size_t lo = page > base ? (page - base) / alloc->block_size : 0;
+    size_t hi = (page + BLOCK_PAGE_SIZE - base + alloc->block_size - 1) / alloc->block_size;
+    size_t found = find_free_near(alloc, index, lo, hi);
+    if (found == NO_FREE_BLOCK) {
+        found = find_free_in_bitmap_line(alloc, index);
+    }
+    if (found == NO_FREE_BLOCK) {
+        return alloc_block(alloc, file, line);
+    }
+    set_bit(alloc->bitmap, found);
+    return prepare_block(alloc, found, file, line);
+}
+
+// Move the live block at src into the free slot dst. The whole block is
+// copied, so the DebugHeader and stomp guards travel with the data.
+static void move_block(BlockAllocator* alloc, size_t src, size_t dst,
+                       BlockRelocate relocate, void* ctx) {
+    uint8_t* src_block = alloc->memory + (src * alloc->block_size);
+    uint8_t* dst_block = alloc->memory + (dst * alloc->block_size);
 #if ENABLE_STOMP_DETECT
-                    uint32_t* pre_ptr = (uint32_t *)block;
-                    int k;
-                    for(k = 0; k < (int)(PRE_BUFFER_STOMP_GUARD_SIZE / sizeof(uint32_t)); k++) {
-                        *pre_ptr++ = pre_stomp_pattern_array[k];
-                    }
-                    block += PRE_BUFFER_STOMP_GUARD_SIZE;
-
-                    uint32_t* post_ptr = (uint32_t*)(block + alloc->block_data_size);
-                    for(k = 0; k < (int)(POST_BUFFER_STOMP_GUARD_SIZE / sizeof(uint32_t)); k++) {
-                        *post_ptr++ = post_stomp_pattern_array[k];
-                    }
+    check_block_for_stomp(alloc, src_block + alloc->data_offset);
 #endif
-                    return (void*)block;
-                }
+    if (alloc->constructed) {
+        // The free slot's cached object is overwritten, so destroy it first
+        if (test_bit(alloc->constructed, dst)) {
+            if (alloc->dtor) {
+                alloc->dtor(dst_block + alloc->data_offset, alloc->block_data_size);
             }
+            clear_bit(alloc->constructed, dst);
+        }
+        if (test_bit(alloc->constructed, src)) {
+            set_bit(alloc->constructed, dst);
+            clear_bit(alloc->constructed, src);
         }
     }
-    return NULL; // No free blocks
+    memcpy(dst_block, src_block, alloc->block_size);
+    set_bit(alloc->bitmap, dst);
+    clear_bit(alloc->bitmap, src);
+    if (alloc->trace) {
+        record_trace_event(alloc->trace, dst, TRACE_OP_ALLOC);
+        record_trace_event(alloc->trace, src, TRACE_OP_FREE);
+    }
+    if (relocate) {
+        relocate(src_block + alloc->data_offset, dst_block + alloc->data_offset, ctx);
+    }
+}
+
+// Compact the pool by moving live blocks from the high end of the region
+// into the lowest free slots, calling relocate for every move. At most
+// budget blocks are moved per call (0 means no limit), so compaction can be
+// spread over several calls; each call resumes from the cursors left by the
+// previous one. Blocks are moved with memcpy; objects that point into
+// themselves must be fixed up by relocate. Shared pools are never
+// compacted, nor pools with an open alloc_mark. Returns the number of
+// blocks moved.
+size_t compact_allocator(BlockAllocator* alloc, BlockRelocate relocate, void* ctx, size_t budget) {
+    if (!alloc || alloc->shm_base || alloc->scope_depth) return 0;
+
+    size_t moved = 0;
+    size_t low = alloc->compact_low;    // Candidate lowest free block
+    size_t high = alloc->compact_high;  // One past the candidate highest live block
+    while (budget == 0 || moved < budget) {
+        while (low < high) {
+            if (low % 8 == 0 && alloc->bitmap[low / 8] == 0xFF) {
+                low += 8;
+            } else if (test_bit(alloc->bitmap, low)) {
+                low++;
+            } else {
+                break;
+            }
+        }
+        while (high > low) {
+            if (high % 8 == 0 && alloc->bitmap[high / 8 - 1] == 0x00) {
+                high -= 8;
+            } else if (!test_bit(alloc->bitmap, high - 1)) {
+                high--;
+            } else {
+                break;
+            }
+        }
+        if (high <= low) break; // Live blocks are already packed below low
+        move_block(alloc, high - 1, low, relocate, ctx);
+        moved++;
+    }
+    alloc->compact_low = low;
+    alloc->compact_high = high;
+    return moved;
 }
 
 int is_allocated(BlockAllocator* alloc, void* ptr) {
@@ -174,9 +1066,7 @@ int is_allocated(BlockAllocator* alloc, void* ptr) {
 
     // Calculate block index
     size_t offset = (uint8_t*)ptr - alloc->memory;
-#if ENABLE_DEBUG_HEADER
     offset -= alloc->data_offset;
-#endif
     ASSERT(offset % alloc->block_size == 0); // Ensure valid pointer
     if (offset % alloc->block_size != 0) return 0;
 
@@ -207,7 +1097,15 @@ void free_block(BlockAllocator* alloc, void* ptr) {
     ASSERT(index < alloc->total_blocks);
 
     if (index < alloc->total_blocks) {
-        clear_bit(alloc->bitmap, index);
+#if ENABLE_DEBUG_HEADER
+        if (alloc->profiler) {
+            profile_free(alloc->profiler, (DebugHeader*)((uint8_t*)ptr - alloc->data_offset));
+        }
+#endif
+        if (alloc->trace) {
+            record_trace_event(alloc->trace, index, TRACE_OP_FREE);
+        }
+        release_bit(alloc, index);
     }
 }
 
@@ -221,7 +1119,9 @@ void dump_allocator(BlockAllocator* alloc) {
         if (test_bit(alloc->bitmap, i)) {
             used++;
             DebugHeader* header = (DebugHeader*)(alloc->memory + (i * alloc->block_size));
-            printf("Block %zu: Allocated at %s:%d\n", i, header->file, header->line);
+            // Shared pools do not record file names, they are not valid across processes
+            printf("Block %zu: Allocated at %s:%d\n", i,
+                   header->file ? header->file : "(unknown)", header->line);
         }
     }
     printf("Total blocks: %zu, Used: %zu, Free: %zu\n",
@@ -233,7 +1133,7 @@ void print_block(BlockAllocator* alloc, void* ptr) {
     uint8_t * byte_ptr = (uint8_t *)ptr - alloc->data_offset;
 #if ENABLE_DEBUG_HEADER
     DebugHeader* header = (DebugHeader *)byte_ptr;
-    printf("Header:\n  File: %s\n  Line: %u", header->file, header->line);
+    printf("Header:\n  File: %s\n  Line: %u", header->file ? header->file : "(unknown)", header->line);
     byte_ptr += sizeof(DebugHeader);
 #endif
 #if ENABLE_STOMP_DETECT
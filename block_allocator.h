@@ -4,14 +4,55 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 // Debug header structure
 #if ENABLE_DEBUG_HEADER
 typedef struct {
     const char* file;
     uint32_t line;
+    uint32_t profile_tag;   // Profiler session that sampled this block, 0 if none
 } DebugHeader;
+
+// Aggregated allocation statistics for one BLOCK_ALLOC callsite. When the
+// profiler samples, counts are scaled up by the sample period.
+typedef struct {
+    const char* file;
+    uint32_t line;
+    size_t live_blocks;     // Estimated blocks from this callsite still allocated
+    size_t total_allocs;    // Estimated allocations since the profiler was enabled
+    double alloc_rate;      // Estimated allocations per second since the last profiler_top_rate
+} CallsiteStats;
 #endif
 
+struct CallsiteProfiler;
+struct AllocTrace;
+
+// Allocation trace file layout: one TraceFileHeader followed by TraceEvent
+// records. Events are grouped per thread, so readers must order them by
+// timestamp before replaying.
+#define TRACE_MAGIC 0x52544142u // "BATR"
+#define TRACE_VERSION 1
+#define TRACE_OP_ALLOC 1
+#define TRACE_OP_FREE 2
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t block_data_size; // Client block size of the traced allocator
+    uint64_t total_blocks;    // Block count of the traced allocator
+} TraceFileHeader;
+
+typedef struct {
+    uint64_t timestamp_ns;  // CLOCK_MONOTONIC time of the event
+    uint32_t index;         // Block index allocated or freed
+    uint16_t thread;        // Small per-trace thread number
+    uint8_t op;             // TRACE_OP_ALLOC or TRACE_OP_FREE
+    uint8_t reserved;
+} TraceEvent;
+
 #if ENABLE_STOMP_DETECT
 extern uint32_t pre_stomp_pattern_array[];
 extern uint32_t post_stomp_pattern_array[];
@@ -19,6 +60,34 @@ extern uint32_t post_stomp_pattern_array[];
 #define POST_BUFFER_STOMP_GUARD_SIZE sizeof(post_stomp_pattern_array)
 #endif
 
+// Object cache callbacks. The constructor runs the first time a block is
+// handed out; the destructor runs only when the block's memory is reclaimed.
+typedef void (*BlockCtor)(void* ptr, size_t size);
+typedef void (*BlockDtor)(void* ptr, size_t size);
+
+// Compaction callback, called after a live block has been copied from
+// old_ptr to new_ptr so the client can fix up its references.
+typedef void (*BlockRelocate)(void* old_ptr, void* new_ptr, void* ctx);
+
+// Cache line size used to stagger blocks in init_colored_allocator
+#ifndef BLOCK_CACHE_LINE_SIZE
+#define BLOCK_CACHE_LINE_SIZE 64
+#endif
+
+// Page size alloc_block_near tries to keep related blocks within
+#ifndef BLOCK_PAGE_SIZE
+#define BLOCK_PAGE_SIZE 4096
+#endif
+
+// Position in the allocation log returned by alloc_mark
+typedef size_t AllocMark;
+
+// Returned by alloc_mark when no scope was opened; rollback and commit ignore it
+#define ALLOC_MARK_NONE ((AllocMark)-1)
+
+// Offset returned by block_to_offset for pointers outside the pool
+#define BLOCK_OFFSET_NONE ((size_t)-1)
+
 // Allocator block structure
 typedef struct BlockAllocator {
     uint8_t* memory;        // Base memory pool
@@ -29,12 +98,43 @@ typedef struct BlockAllocator {
     size_t block_data_size; // The number of bytes in block allocated to client data
     size_t data_offset;     // The number of bytes from the beginning of the block to the
                             // first byte of client data.
+    BlockCtor ctor;         // Optional object constructor (NULL for plain pools)
+    BlockDtor dtor;         // Optional object destructor (NULL for plain pools)
+    uint8_t* constructed;   // Bitmap of blocks holding a constructed object, or NULL
+    struct CallsiteProfiler* profiler; // Per-callsite profiler, NULL when disabled
+    struct AllocTrace* trace;          // Alloc/free event trace, NULL when disabled
+    void* shm_base;         // Shared-memory mapping holding the pool, NULL for heap pools
+    size_t shm_size;        // Size of the shared-memory mapping
+    size_t* scope_log;      // Indices of blocks allocated while a mark is open
+    size_t scope_log_len;
+    size_t scope_log_cap;
+    size_t scope_depth;     // Number of open marks
+    size_t scanned_bytes;   // Bitmap bytes examined by allocation scans in this process
+    size_t compact_low;     // Every block below this index is allocated
+    size_t compact_high;    // Every block at or above this index is free
 } BlockAllocator;
 
 BlockAllocator* init_allocator(size_t block_size, size_t total_size);
+BlockAllocator* init_colored_allocator(size_t block_size, size_t total_size);
+BlockAllocator* init_object_allocator(size_t block_size, size_t total_size,
+                                      BlockCtor ctor, BlockDtor dtor);
+size_t reclaim_free_blocks(BlockAllocator* alloc);
+BlockAllocator* create_shared_allocator(const char* name, size_t block_size, size_t total_size);
+BlockAllocator* attach_shared_allocator(const char* name);
+int unlink_shared_allocator(const char* name);
+size_t block_to_offset(BlockAllocator* alloc, void* ptr);
+void* offset_to_block(BlockAllocator* alloc, size_t offset);
+int start_trace(BlockAllocator* alloc, const char* path);
+void stop_trace(BlockAllocator* alloc);
 void free_allocator(BlockAllocator* alloc);
 void* alloc_block(BlockAllocator* alloc, const char* file, int line);
+void* alloc_block_near(BlockAllocator* alloc, void* hint, const char* file, int line);
 void free_block(BlockAllocator* alloc, void* ptr);
+// Returns ALLOC_MARK_NONE for a NULL allocator or a shared pool
+AllocMark alloc_mark(BlockAllocator* alloc);
+void alloc_rollback(BlockAllocator* alloc, AllocMark mark);
+void alloc_commit(BlockAllocator* alloc, AllocMark mark);
+size_t compact_allocator(BlockAllocator* alloc, BlockRelocate relocate, void* ctx, size_t budget);
 void check_for_stomps(BlockAllocator* alloc);
 void set_bit(uint8_t* bitmap, size_t index);
 void clear_bit(uint8_t* bitmap, size_t index);
@@ -43,14 +143,24 @@ int is_allocated(BlockAllocator* alloc, void *);
 void print_block(BlockAllocator* alloc, void* ptr);
 #if ENABLE_DEBUG_HEADER
 void dump_allocator(BlockAllocator* alloc);
+int enable_profiler(BlockAllocator* alloc, uint32_t sample_period);
+void disable_profiler(BlockAllocator* alloc);
+size_t profiler_top_live(BlockAllocator* alloc, CallsiteStats* out, size_t n);
+size_t profiler_top_rate(BlockAllocator* alloc, CallsiteStats* out, size_t n);
 #endif
 
 // Client-facing macros
 #if ENABLE_DEBUG_HEADER
 #define BLOCK_ALLOC(alloc) alloc_block((alloc), __FILE__, __LINE__)
+#define BLOCK_ALLOC_NEAR(alloc, hint) alloc_block_near((alloc), (hint), __FILE__, __LINE__)
 #else
 #define BLOCK_ALLOC(alloc) alloc_block((alloc), NULL, 0)
+#define BLOCK_ALLOC_NEAR(alloc, hint) alloc_block_near((alloc), (hint), NULL, 0)
 #endif
 #define BLOCK_FREE(alloc, ptr) free_block((alloc), (ptr))
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,180 @@
+#ifndef BLOCK_ALLOCATOR_HPP
+#define BLOCK_ALLOCATOR_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <memory_resource>
+#include <new>
+
+#include "block_allocator.h"
+
+namespace block_allocator {
+
+// std::pmr::memory_resource that serves node-sized requests from a
+// BlockAllocator and forwards everything else, including requests made
+// once the pool is full, to an upstream resource. Intended for node based
+// containers (list, map, unordered_map) whose element allocations all have
+// the same size.
+//
+// Allocation is O(1). Deallocated nodes stay allocated in the pool and are
+// kept on a LIFO free list threaded through their first bytes; fresh blocks
+// are taken in address order with BLOCK_ALLOC_NEAR on the previous one,
+// which finds the next block immediately. The pool is only searched once
+// both are empty, and not again after it has been found full.
+class BlockMemoryResource : public std::pmr::memory_resource {
+public:
+    // node_size is the largest request served from the pool, node_count the
+    // number of blocks in it. Throws std::bad_alloc if the pool can't be made.
+    BlockMemoryResource(std::size_t node_size, std::size_t node_count,
+                        std::pmr::memory_resource* upstream = std::pmr::get_default_resource())
+        : pool_(init_allocator(block_size_for(node_size), block_size_for(node_size) * node_count)),
+          upstream_(upstream) {
+        if (!pool_) throw std::bad_alloc();
+        // Blocks start at malloc alignment plus multiples of the stride and
+        // data offset, so they share the largest alignment dividing all three.
+        alignment_ = alignof(std::max_align_t);
+        while (alignment_ > 1 && (pool_->block_size % alignment_ || pool_->data_offset % alignment_)) {
+            alignment_ /= 2;
+        }
+    }
+
+    ~BlockMemoryResource() override { free_allocator(pool_); }
+
+    BlockMemoryResource(const BlockMemoryResource&) = delete;
+    BlockMemoryResource& operator=(const BlockMemoryResource&) = delete;
+
+    BlockAllocator* pool() const noexcept { return pool_; }
+    std::size_t node_size() const noexcept { return pool_->block_data_size; }
+    std::pmr::memory_resource* upstream() const noexcept { return upstream_; }
+
+    // True if p was handed out from the pool rather than upstream
+    bool owns(const void* p) const noexcept {
+        const std::uint8_t* byte = static_cast<const std::uint8_t*>(p);
+        return byte >= pool_->memory && byte < pool_->memory + pool_->total_size;
+    }
+
+protected:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+        if (bytes <= pool_->block_data_size && alignment <= alignment_) {
+            if (free_list_) {
+                void* p = free_list_;
+                std::memcpy(&free_list_, p, sizeof(void*));
+                return p;
+            }
+            if (!exhausted_) {
+                void* p = BLOCK_ALLOC_NEAR(pool_, last_);
+                if (p) return last_ = p;
+                exhausted_ = true;
+            }
+        }
+        return upstream_->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override {
+        if (owns(p)) {
+            std::memcpy(p, &free_list_, sizeof(void*));
+            free_list_ = p;
+        } else {
+            upstream_->deallocate(p, bytes, alignment);
+        }
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+
+private:
+    // Blocks must be able to hold the free list link
+    static std::size_t block_size_for(std::size_t node_size) noexcept {
+        return node_size > sizeof(void*) ? node_size : sizeof(void*);
+    }
+
+    BlockAllocator* pool_;
+    std::pmr::memory_resource* upstream_;
+    std::size_t alignment_;
+    void* free_list_ = nullptr;     // Deallocated nodes, still allocated in the pool
+    void* last_ = nullptr;          // Most recent block taken from the pool
+    bool exhausted_ = false;        // The pool had no free block left
+};
+
+// Classic allocator for containers that take an Allocator template argument
+// rather than a std::pmr::polymorphic_allocator. Every rebound copy shares
+// the same BlockMemoryResource.
+template <class T>
+class BlockStlAllocator {
+public:
+    using value_type = T;
+
+    explicit BlockStlAllocator(BlockMemoryResource* resource) noexcept : resource_(resource) {}
+
+    template <class U>
+    BlockStlAllocator(const BlockStlAllocator<U>& other) noexcept : resource_(other.resource()) {}
+
+    T* allocate(std::size_t n) {
+        if (n > std::numeric_limits<std::size_t>::max() / sizeof(T)) throw std::bad_array_new_length();
+        return static_cast<T*>(resource_->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept {
+        resource_->deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    BlockMemoryResource* resource() const noexcept { return resource_; }
+
+private:
+    BlockMemoryResource* resource_;
+};
+
+template <class T, class U>
+bool operator==(const BlockStlAllocator<T>& a, const BlockStlAllocator<U>& b) noexcept {
+    return a.resource() == b.resource();
+}
+
+template <class T, class U>
+bool operator!=(const BlockStlAllocator<T>& a, const BlockStlAllocator<U>& b) noexcept {
+    return a.resource() != b.resource();
+}
+
+// Find the node size of a std::pmr container by inserting a few elements
+// through a recording resource and taking the most frequent request size.
+// Bucket arrays and other one-off allocations are outvoted by the nodes.
+//   probe_node_size<std::pmr::map<int, int>>([](auto& m, int i) { m.emplace(i, i); });
+template <class PmrContainer, class Insert>
+std::size_t probe_node_size(Insert insert, int elements = 8) {
+    class RecordingResource : public std::pmr::memory_resource {
+    public:
+        std::map<std::size_t, int> sizes;
+    private:
+        void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+            sizes[bytes]++;
+            return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+        }
+        void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override {
+            std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+        }
+        bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+            return this == &other;
+        }
+    } recorder;
+
+    {
+        PmrContainer container(&recorder);
+        for (int i = 0; i < elements; i++) insert(container, i);
+    }
+    std::size_t node_size = 0;
+    int best = 0;
+    for (const auto& entry : recorder.sizes) {
+        if (entry.second > best) {
+            best = entry.second;
+            node_size = entry.first;
+        }
+    }
+    return node_size;
+}
+
+} // namespace block_allocator
+
+#endif
@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "block_allocator.h"
+
+// Replays an allocation trace written by start_trace against an allocator
+// configuration and reports throughput, peak occupancy and bitmap scan cost.
+//
+// Usage: replay [--colored] [--near] <trace file> [block_size [total_size]]
+// block_size and total_size default to the traced allocator's configuration.
+// --colored replays into init_colored_allocator. --near allocates with
+// BLOCK_ALLOC_NEAR, hinting each thread's previous allocation.
+
+#define REPLAY_THREADS 65536 // TraceEvent.thread is 16 bits
+
+typedef struct {
+    TraceEvent event;
+    size_t position;        // Order within the file, keeps sorting stable
+} ReplayEvent;
+
+static int compare_events(const void* a, const void* b) {
+    const ReplayEvent* ea = a;
+    const ReplayEvent* eb = b;
+    if (ea->event.timestamp_ns != eb->event.timestamp_ns) {
+        return ea->event.timestamp_ns < eb->event.timestamp_ns ? -1 : 1;
+    }
+    if (ea->position != eb->position) {
+        return ea->position < eb->position ? -1 : 1;
+    }
+    return 0;
+}
+
+static double elapsed_seconds(struct timespec* start, struct timespec* end) {
+    return (double)(end->tv_sec - start->tv_sec) +
+           (double)(end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char** argv) {
+    int colored = 0, near = 0;
+    char* args[3];
+    int nargs = 0;
+    int a;
+    for (a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "--colored") == 0) {
+            colored = 1;
+        } else if (strcmp(argv[a], "--near") == 0) {
+            near = 1;
+        } else if (nargs < 3 && argv[a][0] != '-') {
+            args[nargs++] = argv[a];
+        } else {
+            nargs = 0;
+            break;
+        }
+    }
+    if (nargs == 0) {
+        printf("Usage: %s [--colored] [--near] <trace file> [block_size [total_size]]\n", argv[0]);
+        return 1;
+    }
+    FILE* file = fopen(args[0], "rb");
+    if (!file) {
+        printf("Failed to open %s\n", args[0]);
+        return 1;
+    }
+    TraceFileHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+            header.magic != TRACE_MAGIC || header.version != TRACE_VERSION) {
+        printf("%s is not a block allocator trace\n", args[0]);
+        fclose(file);
+        return 1;
+    }
+
+    // Read every event, growing the array as needed
+    size_t count = 0, capacity = 1024;
+    ReplayEvent* events = malloc(capacity * sizeof(ReplayEvent));
+    TraceEvent event;
+    while (events && fread(&event, sizeof(event), 1, file) == 1) {
+        if (count == capacity) {
+            capacity *= 2;
+            ReplayEvent* grown = realloc(events, capacity * sizeof(ReplayEvent));
+            if (!grown) {
+                free(events);
+                events = NULL;
+                break;
+            }
+            events = grown;
+        }
+        events[count].event = event;
+        events[count].position = count;
+        count++;
+    }
+    fclose(file);
+    if (!events) {
+        printf("Out of memory reading trace\n");
+        return 1;
+    }
+    qsort(events, count, sizeof(ReplayEvent), compare_events);
+
+    size_t block_size = nargs > 1 ? strtoul(args[1], NULL, 0) : header.block_data_size;
+    size_t total_size = nargs > 2 ? strtoul(args[2], NULL, 0)
+                                  : header.block_data_size * header.total_blocks;
+    BlockAllocator* alloc = colored ? init_colored_allocator(block_size, total_size)
+                                    : init_allocator(block_size, total_size);
+    void** live = calloc(header.total_blocks, sizeof(void*));
+    void** last = near ? calloc(REPLAY_THREADS, sizeof(void*)) : NULL;
+    if (!alloc || !live || (near && !last)) {
+        printf("Failed to initialize allocator\n");
+        free(events);
+        free(live);
+        free(last);
+        free_allocator(alloc);
+        return 1;
+    }
+
+    size_t allocs = 0, frees = 0, failed = 0, skipped = 0;
+    size_t occupancy = 0, peak = 0;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    size_t i;
+    for (i = 0; i < count; i++) {
+        TraceEvent* e = &events[i].event;
+        if (e->index >= header.total_blocks) {
+            skipped++;
+            continue;
+        }
+        if (e->op == TRACE_OP_ALLOC) {
+            if (live[e->index]) {
+                skipped++; // Trace lost the matching free
+                continue;
+            }
+            void* ptr = near ? BLOCK_ALLOC_NEAR(alloc, last[e->thread]) : BLOCK_ALLOC(alloc);
+            if (!ptr) {
+                failed++;
+                continue;
+            }
+            live[e->index] = ptr;
+            if (near) last[e->thread] = ptr;
+            allocs++;
+            if (++occupancy > peak) peak = occupancy;
+        } else if (e->op == TRACE_OP_FREE) {
+            if (!live[e->index]) {
+                skipped++;
+                continue;
+            }
+            BLOCK_FREE(alloc, live[e->index]);
+            live[e->index] = NULL;
+            frees++;
+            occupancy--;
+        } else {
+            skipped++;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = elapsed_seconds(&start, &end);
+
+    printf("Trace: %s (%zu events, traced block_size=%llu, blocks=%llu)\n", args[0], count,
+           (unsigned long long)header.block_data_size, (unsigned long long)header.total_blocks);
+    printf("Replay allocator: block_size=%zu, blocks=%zu, stride=%zu%s%s\n", alloc->block_data_size,
+           alloc->total_blocks, alloc->block_size, colored ? ", colored" : "", near ? ", near" : "");
+    printf("Allocs: %zu, Frees: %zu, Failed allocs: %zu, Skipped events: %zu\n",
+           allocs, frees, failed, skipped);
+    printf("Elapsed: %.6f s, Throughput: %.0f ops/s\n",
+           seconds, seconds > 0 ? (double)(allocs + frees) / seconds : 0.0);
+    printf("Peak occupancy: %zu blocks (%.1f%%)\n",
+           peak, alloc->total_blocks ? 100.0 * (double)peak / (double)alloc->total_blocks : 0.0);
+    printf("Scan cost: %.1f bitmap bytes per alloc\n",
+           allocs + failed ? (double)alloc->scanned_bytes / (double)(allocs + failed) : 0.0);
+
+    for (i = 0; i < header.total_blocks; i++) {
+        if (live[i]) BLOCK_FREE(alloc, live[i]);
+    }
+    free(live);
+    free(last);
+    free(events);
+    free_allocator(alloc);
+    return 0;
+}
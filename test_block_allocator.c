@@ -1,6 +1,9 @@
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #include "block_allocator.h"
 #include "proxy_assert.h"
 #include "proxy_malloc.h"
@@ -387,6 +390,641 @@ TEST(nearly_full_allocator) {
     free_allocator(alloc);
 }
 
+// Object cache helpers
+static int ctor_calls = 0;
+static int dtor_calls = 0;
+static void count_ctor(void* ptr, size_t size) {
+    memset(ptr, 0xAB, size);
+    ctor_calls++;
+}
+static void count_dtor(void* ptr, size_t size) {
+    (void)ptr;
+    (void)size;
+    dtor_calls++;
+}
+
+// Test constructed state survives free and re-alloc
+TEST(object_cache_preserves_state) {
+    ENABLE_ASSERT();
+    NORMAL_MALLOC();
+    ctor_calls = 0;
+    dtor_calls = 0;
+    BlockAllocator* alloc = init_object_allocator(BLOCK_SIZE, BLOCK_SIZE * 4, count_ctor, count_dtor);
+    assert(alloc != NULL);
+    assert(alloc->constructed != NULL);
+
+    uint8_t* ptr = BLOCK_ALLOC(alloc);
+    assert(ptr != NULL);
+    assert(ctor_calls == 1);
+    assert(ptr[0] == 0xAB && ptr[BLOCK_SIZE - 1] == 0xAB);
+    ptr[0] = 0x11; // Client state kept across the free/alloc cycle
+    BLOCK_FREE(alloc, ptr);
+    assert(dtor_calls == 0);
+
+    uint8_t* again = BLOCK_ALLOC(alloc);
+    assert(again == ptr);
+    assert(ctor_calls == 1);
+    assert(again[0] == 0x11);
+
+    uint8_t* second = BLOCK_ALLOC(alloc);
+    assert(second != NULL);
+    assert(ctor_calls == 2);
+
+    free_allocator(alloc);
+    assert(dtor_calls == 2);
+}
+
+// Test reclaiming destroys only free constructed blocks
+TEST(object_cache_reclaim) {
+    ENABLE_ASSERT();
+    NORMAL_MALLOC();
+    ctor_calls = 0;
+    dtor_calls = 0;
+    BlockAllocator* alloc = init_object_allocator(BLOCK_SIZE, BLOCK_SIZE * 16, count_ctor, count_dtor);
+    assert(alloc != NULL);
+    void* ptrs[10];
+    for (int i = 0; i < 10; i++) {
+        ptrs[i] = BLOCK_ALLOC(alloc);
+        assert(ptrs[i] != NULL);
+    }
+    for (int i = 0; i < 10; i += 2) {
+        BLOCK_FREE(alloc, ptrs[i]);
+    }
+    assert(reclaim_free_blocks(alloc) == 5);
+    assert(dtor_calls == 5);
+    assert(reclaim_free_blocks(alloc) == 0);
+
+    void* ptr = BLOCK_ALLOC(alloc);
+    assert(ptr == ptrs[0]);
+    assert(ctor_calls == 11); // Reclaimed block is constructed again
+
+    assert(reclaim_free_blocks(NULL) == 0);
+    free_allocator(alloc);
+    assert(dtor_calls == 11);
+}
+
+#ifdef TEST_MALLOC
+// Test failure allocating the constructed bitmap
+TEST(object_cache_malloc_failure) {
+    ENABLE_ASSERT();
+    FAIL_MALLOC(3, 4);
+    BlockAllocator* alloc = init_object_allocator(BLOCK_SIZE, TOTAL_SIZE, count_ctor, NULL);
+    assert(alloc == NULL);
+    ASSERT_FAIL_COUNT(1);
+    NORMAL_MALLOC();
+}
+#endif // TEST_MALLOC
+
+#if ENABLE_DEBUG_HEADER
+static void* alloc_from_site_a(BlockAllocator* alloc) { return BLOCK_ALLOC(alloc); }
+static void* alloc_from_site_b(BlockAllocator* alloc) { return BLOCK_ALLOC(alloc); }
+
+// Test per-callsite live counts and ordering
+TEST(profiler_callsites) {
+    ENABLE_ASSERT();
+    NORMAL_MALLOC();
+    BlockAllocator* alloc = init_allocator(BLOCK_SIZE, TOTAL_SIZE);
+    assert(alloc != NULL);
+    void* before = BLOCK_ALLOC(alloc); // Not counted, profiler not yet enabled
+    assert(enable_profiler(alloc, 1) == 0);
+
+    void* a[10];
+    void* b[4];
+    for (int i = 0; i < 10; i++) a[i] = alloc_from_site_a(alloc);
+    for (int i = 0; i < 4; i++) b[i] = alloc_from_site_b(alloc);
+    for (int i = 0; i < 8; i++) BLOCK_FREE(alloc, a[i]);
+    BLOCK_FREE(alloc, a[0]); // Double free must not be counted twice
+    BLOCK_FREE(alloc, before);
+
+    CallsiteStats stats[4];
+    assert(profiler_top_live(alloc, stats, 4) == 2);
+    assert(stats[0].live_blocks == 4 && stats[0].total_allocs == 4);
+    assert(stats[1].live_blocks == 2 && stats[1].total_allocs == 10);
+    assert(stats[0].line != stats[1].line);
+    assert(strcmp(stats[0].file, __FILE__) == 0);
+
+    assert(profiler_top_rate(alloc, stats, 1) == 1);
+    assert(stats[0].total_allocs == 10);
+    assert(stats[0].alloc_rate >= 0.0);
+
+    // Rates cover the window since the previous report, not the lifetime
+    void* c[2];
+    for (int i = 0; i < 2; i++) c[i] = alloc_from_site_b(alloc);
+    assert(profiler_top_rate(alloc, stats, 2) == 2);
+    assert(stats[0].total_allocs == 6 && stats[0].alloc_rate > 0.0);
+    assert(stats[1].total_allocs == 10 && stats[1].alloc_rate == 0.0);
+    for (int i = 0; i < 2; i++) BLOCK_FREE(alloc, c[i]);
+
+    disable_profiler(alloc);
+    assert(profiler_top_live(alloc, stats, 4) == 0);
+    for (int i = 8; i < 10; i++) BLOCK_FREE(alloc, a[i]);
+    for (int i = 0; i < 4; i++) BLOCK_FREE(alloc, b[i]);
+    free_allocator(alloc);
+}
+
+// Test sampling and hash table growth across many callsites
+TEST(profiler_sampling) {
+    ENABLE_ASSERT();
+    NORMAL_MALLOC();
+    BlockAllocator* alloc = init_allocator(BLOCK_SIZE, TOTAL_SIZE);
+    assert(alloc != NULL);
+    assert(enable_profiler(alloc, 4) == 0);
+    void* ptrs[400];
+    for (int i = 0; i < 400; i++) {
+        // Synthesize 100 distinct callsites, four allocations each
+        ptrs[i] = alloc_block(alloc, __FILE__, 1000 + (i / 4));
+        assert(ptrs[i] != NULL);
+    }
+    CallsiteStats stats[200];
+    assert(profiler_top_live(alloc, stats, 200) == 100);
+    for (int i = 0; i < 100; i++) {
+        assert(stats[i].live_blocks == 4);
+    }
+    for (int i = 0; i < 400; i++) BLOCK_FREE(alloc, ptrs[i]);
+    assert(profiler_top_live(alloc, stats, 1) == 1);
+    assert(stats[0].live_blocks == 0);
+    free_allocator(alloc); // Releases the profiler
+}
+#endif
+
+#define TRACE_PATH "test_trace.bin"
+
+static void* trace_thread(void* arg) {
+    BlockAllocator* alloc = arg;
+    void* ptr = BLOCK_ALLOC(alloc);
+    BLOCK_FREE(alloc, ptr);
+    return NULL;
+}
+
+// Test trace file contents, including a buffer flush and a second thread
+TEST(trace_recording) {
+    ENABLE_ASSERT();
+    NORMAL_MALLOC();
+    BlockAllocator* alloc = init_allocator(BLOCK_SIZE, TOTAL_SIZE);
+    assert(alloc != NULL);
+    void* untraced = BLOCK_ALLOC(alloc);
+    assert(start_trace(alloc, TRACE_PATH) == 0);
+
+    void* ptr = BLOCK_ALLOC(alloc);
+    BLOCK_FREE(alloc, ptr);
+    for (int i = 0; i < 5000; i++) { // Overflows one per-thread buffer
+        ptr = BLOCK_ALLOC(alloc);
+        BLOCK_FREE(alloc, ptr);
+    }
+    pthread_t thread;
+    assert(pthread_create(&thread, NULL, trace_thread, alloc) == 0);
+    assert(pthread_join(thread, NULL) == 0);
+    stop_trace(alloc);
+    BLOCK_FREE(alloc, untraced);
+
+    FILE* file = fopen(TRACE_PATH, "rb");
+    assert(file != NULL);
+    TraceFileHeader header;
+    assert(fread(&header, sizeof(header), 1, file) == 1);
+    assert(header.magic == TRACE_MAGIC);
+    assert(header.version == TRACE_VERSION);
+    assert(header.block_data_size == BLOCK_SIZE);
+    assert(header.total_blocks == alloc->total_blocks);
+
+    TraceEvent event;
+    size_t events = 0, allocs = 0, other_thread = 0;
+    uint16_t main_thread = 0xFFFF;
+    while (fread(&event, sizeof(event), 1, file) == 1) {
+        if (events == 0) {
+            main_thread = event.thread; // First flush belongs to this thread
+            assert(event.op == TRACE_OP_ALLOC);
+            assert(event.index == 1);
+        }
+        assert(event.op == TRACE_OP_ALLOC || event.op == TRACE_OP_FREE);
+        assert(event.index == 1);
+        if (event.op == TRACE_OP_ALLOC) allocs++;
+        if (event.thread != main_thread) other_thread++;
+        events++;
+    }
+    fclose(file);
+    remove(TRACE_PATH);
+    assert(events == 2 * 5002);
+    assert(allocs == 5002);
+    assert(other_thread == 2);
+
+    assert(start_trace(alloc, "/nonexistent/dir/trace.bin") == -1);
+    assert(start_trace(NULL, TRACE_PATH) == -1);
+    stop_trace(NULL);
+    free_allocator(alloc);
+}
+
+// Test passing a block between processes by offset
+TEST(shared_pool_ipc) {
+    ENABLE_ASSERT();
+    NORMAL_MALLOC();
+    char name[64];
+    snprintf(name, sizeof(name), "/block_allocator_test_%d", (int)getpid());
+    unlink_shared_allocator(name);
+
+    BlockAllocator* alloc = create_shared_allocator(name, BLOCK_SIZE, BLOCK_SIZE * 64);
+    assert(alloc != NULL);
+    assert(alloc->total_blocks == 64);
+    assert(create_shared_allocator(name, BLOCK_SIZE, BLOCK_SIZE * 64) == NULL); // Name taken
+
+    void* first = BLOCK_ALLOC(alloc);
+    char* msg = BLOCK_ALLOC(alloc);
+    assert(first != NULL && msg != NULL);
+    strcpy(msg, "hello from the parent");
+    size_t offset = block_to_offset(alloc, msg);
+    assert(offset != BLOCK_OFFSET_NONE);
+    assert(offset_to_block(alloc, offset) == msg);
+    assert(block_to_offset(alloc, (char*)msg + 1) == BLOCK_OFFSET_NONE);
+    assert(offset_to_block(alloc, offset + 1) == NULL);
+    assert(offset_to_block(alloc, alloc->total_size) == NULL);
+
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        // Child: attach, read the message, reply in a new block and free the original
+        BlockAllocator* child = attach_shared_allocator(name);
+        if (!child) _exit(1);
+        char* received = offset_to_block(child, offset);
+        if (!received || strcmp(received, "hello from the parent") != 0) _exit(2);
+        char* reply = BLOCK_ALLOC(child);
+        if (!reply) _exit(3);
+        strcpy(reply, "reply");
+        BLOCK_FREE(child, received);
+        free_allocator(child);
+        _exit(0);
+    }
+    int status;
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    // The child took block 2 and freed block 1
+    assert(is_block_allocated(alloc, 0));
+    assert(!is_block_allocated(alloc, 1));
+    assert(is_block_allocated(alloc, 2));
+    char* reply = (char*)alloc->memory + alloc->data_offset + 2 * alloc->block_size;
+    assert(strcmp(reply, "reply") == 0);
+
+    // Fill the pool, a full pool returns NULL
+    void* ptrs[64];
+    size_t n = 0;
+    while ((ptrs[n] = BLOCK_ALLOC(alloc)) != NULL) n++;
+    assert(n == 62);
+    for (size_t i = 0; i < n; i++) BLOCK_FREE(alloc, ptrs[i]);
+    BLOCK_FREE(alloc, first);
+    BLOCK_FREE(alloc, reply);
+
+    assert(unlink_shared_allocator(name) == 0);
+    assert(attach_shared_allocator(name) == NULL);
+    free_allocator(alloc);
+}
+
+// Relocation bookkeeping for compaction tests
+typedef struct {
+    void* old_ptrs[64];
+    void* new_ptrs[64];
+    size_t count;
+} RelocationLog;
+
+static void log_relocation(void* old_ptr, void* new_ptr, void* ctx) {
+    RelocationLog* log = ctx;
+    log->old_ptrs[log->count] = old_ptr;
+    log->new_ptrs[log->count] = new_ptr;
+    log->count++;
+}
+
+// Test compaction packs live blocks low, incrementally and with data intact
+TEST(compact_allocator) {
+    ENABLE_ASSERT();
+    NORMAL_MALLOC();
+    BlockAllocator* alloc = init_allocator(BLOCK_SIZE, BLOCK_SIZE * 32);
+    assert(alloc != NULL);
+    uint8_t* ptrs[32];
+    for (int i = 0; i < 32; i++) {
+        ptrs[i] = BLOCK_ALLOC(alloc);
+        memset(ptrs[i], i, BLOCK_SIZE);
+    }
+    // Keep blocks 3, 17, 20 and 31 live
+    for (int i = 0; i < 32; i++) {
+        if (i != 3 && i != 17 && i != 20 && i != 31) BLOCK_FREE(alloc, ptrs[i]);
+    }
+
+    RelocationLog log;
+    log.count = 0;
+    assert(compact_allocator(alloc, log_relocation, &log, 2) == 2); // Budget honoured
+    assert(log.count == 2);
+    assert(log.old_ptrs[0] == ptrs[31] && log.new_ptrs[0] == ptrs[0]);
+    assert(log.old_ptrs[1] == ptrs[20] && log.new_ptrs[1] == ptrs[1]);
+
+    assert(compact_allocator(alloc, log_relocation, &log, 0) == 1);
+    assert(log.old_ptrs[2] == ptrs[17] && log.new_ptrs[2] == ptrs[2]);
+    assert(compact_allocator(alloc, log_relocation, &log, 0) == 0); // Already packed
+
+    for (int i = 0; i < 4; i++) assert(is_block_allocated(alloc, i));
+    for (int i = 4; i < 32; i++) assert(!is_block_allocated(alloc, i));
+    assert(ptrs[0][0] == 31 && ptrs[0][BLOCK_SIZE - 1] == 31);
+    assert(ptrs[1][0] == 20 && ptrs[2][0] == 17 && ptrs[3][0] == 3);
+#if ENABLE_DEBUG_HEADER
+    DebugHeader* header = (DebugHeader*)(ptrs[0] - alloc->data_offset);
+    assert(header->file != NULL && header->line > 0);
+#endif
+    assert(alloc->compact_low == 4 && alloc->compact_high == 4); // Next call resumes here
+
+    // A free below the cursors and an alloc above them are still compacted
+    BLOCK_FREE(alloc, ptrs[1]);
+    assert(alloc->compact_low == 1);
+    assert(BLOCK_ALLOC_NEAR(alloc, ptrs[31]) == ptrs[31]);
+    assert(alloc->compact_high == 32);
+    log.count = 0;
+    assert(compact_allocator(alloc, log_relocation, &log, 0) == 1);
+    assert(log.old_ptrs[0] == ptrs[31] && log.new_ptrs[0] == ptrs[1]);
+    for (int i = 0; i < 4; i++) BLOCK_FREE(alloc, ptrs[i]); // Guards moved intact
+
+    assert(compact_allocator(NULL, NULL, NULL, 0) == 0);
+    free_allocator(alloc);
+}
+
+// Test compaction keeps constructed state with the moved objects
+TEST(compact_object_allocator) {
+    ENABLE_ASSERT();
+    NORMAL_MALLOC();
+    ctor_calls = 0;
+    dtor_calls = 0;
+    BlockAllocator* alloc = init_object_allocator(BLOCK_SIZE, BLOCK_SIZE * 8, count_ctor, count_dtor);
+    assert(alloc != NULL);
+    void* ptrs[8];
+    for (int i = 0; i < 8; i++) ptrs[i] = BLOCK_ALLOC(alloc);
+    for (int i = 0; i < 7; i++) BLOCK_FREE(alloc, ptrs[i]);
+
+    assert(compact_allocator(alloc, NULL, NULL, 0) == 1);
+    assert(dtor_calls == 1); // Cached object in slot 0 was overwritten
+    assert(is_block_allocated(alloc, 0));
+    assert(test_bit(alloc->constructed, 0));
+    assert(!test_bit(alloc->constructed, 7));
+
+    BLOCK_FREE(alloc, ptrs[0]);
+    free_allocator(alloc);
+    assert(dtor_calls == 8); // Seven cached objects plus the one overwritten
+}
+
+// Test rollback frees only blocks allocated since the mark, with nesting
+TEST(mark_rollback) {
+    ENABLE_ASSERT();
+    NORMAL_MALLOC();
+    BlockAllocator* alloc = init_allocator(BLOCK_SIZE, BLOCK_SIZE * 256);
+    assert(alloc != NULL);
+    void* before = BLOCK_ALLOC(alloc);
+
+    AllocMark outer = alloc_mark(alloc);
+    void* outer_ptrs[100];
+    for (int i = 0; i < 100; i++) { // Grows the scope log past its first size
+        outer_ptrs[i] = BLOCK_ALLOC(alloc);
+        assert(outer_ptrs[i] != NULL);
+    }
+    BLOCK_FREE(alloc, outer_ptrs[5]); // Freed by the client inside the scope
+    assert(compact_allocator(alloc, NULL, NULL, 0) == 0); // Refused while a mark is open
+
+    AllocMark inner = alloc_mark(alloc);
+    void* inner_ptrs[10];
+    for (int i = 0; i < 10; i++) inner_ptrs[i] = BLOCK_ALLOC(alloc);
+    assert(inner_ptrs[0] == outer_ptrs[5]); // Slot reused inside the inner scope
+    alloc_rollback(alloc, inner);
+    for (int i = 0; i < 10; i++) assert(!is_allocated(alloc, inner_ptrs[i]));
+    assert(is_allocated(alloc, outer_ptrs[99]));
+
+    AllocMark committed = alloc_mark(alloc);
+    void* kept = BLOCK_ALLOC(alloc);
+    alloc_commit(alloc, committed); // Handed to the outer scope
+
+    alloc_rollback(alloc, outer);
+    assert(!is_allocated(alloc, kept));
+    for (int i = 0; i < 100; i++) assert(!is_allocated(alloc, outer_ptrs[i]));
+    assert(is_allocated(alloc, before));
+    assert(alloc->scope_depth == 0 && alloc->scope_log_len == 0);
+
+    // Allocations outside any scope are not logged
+    void* after = BLOCK_ALLOC(alloc);
+    assert(alloc->scope_log_len == 0);
+
+    AllocMark last = alloc_mark(alloc);
+    void* committed_ptr = BLOCK_ALLOC(alloc);
+    alloc_commit(alloc, last);
+    assert(alloc->scope_depth == 0 && alloc->scope_log_len == 0);
+    assert(is_allocated(alloc, committed_ptr));
+
+    BLOCK_FREE(alloc, committed_ptr);
+    BLOCK_FREE(alloc, after);
+    BLOCK_FREE(alloc, before);
+    assert(alloc_mark(NULL) == ALLOC_MARK_NONE);
+    alloc_rollback(NULL, 0);
+    alloc_commit(NULL, 0);
+    free_allocator(alloc);
+}
+
+// Test detaching ignores blocks another process has claimed but not set up
+TEST(shared_pool_detach_skips_stomp_scan) {
+    ENABLE_ASSERT();
+    NORMAL_MALLOC();
+    char name[64];
+    snprintf(name, sizeof(name), "/block_allocator_detach_%d", (int)getpid());
+    unlink_shared_allocator(name);
+    BlockAllocator* alloc = create_shared_allocator(name, BLOCK_SIZE, BLOCK_SIZE * 16);
+    assert(alloc != NULL);
+    BlockAllocator* other = attach_shared_allocator(name);
+    assert(other != NULL);
+
+    // Another process won the bit but hasn't written the guards yet
+    set_bit(alloc->bitmap, 3);
+    free_allocator(other); // Must not scan the guards of block 3
+
+    clear_bit(alloc->bitmap, 3);
+    assert(unlink_shared_allocator(name) == 0);
+    free_allocator(alloc);
+}
+
+// Test attaching refuses a segment whose header describes an impossible layout
+TEST(shared_pool_attach_validates_header) {
+    ENABLE_ASSERT();
+    NORMAL_MALLOC();
+    char name[64];
+    snprintf(name, sizeof(name), "/block_allocator_header_%d", (int)getpid());
+    unlink_shared_allocator(name);
+    BlockAllocator* alloc = create_shared_allocator(name, BLOCK_SIZE, BLOCK_SIZE * 16);
+    assert(alloc != NULL);
+    // Field order of the segment header: magic, version, block_size,
+    // block_data_size, data_offset, total_blocks, bitmap_offset, memory_offset
+    uint64_t* fields = (uint64_t*)alloc->shm_base + 1;
+    uint64_t saved[6];
+    memcpy(saved, fields, sizeof(saved));
+
+    fields[1] = 0; // block_data_size, divides in the layout
+    assert(attach_shared_allocator(name) == NULL);
+    memcpy(fields, saved, sizeof(saved));
+    fields[3] = UINT64_MAX / 2; // total_blocks overflowing the segment
+    assert(attach_shared_allocator(name) == NULL);
+    memcpy(fields, saved, sizeof(saved));
+    fields[5] = saved[4] + 1; // memory_offset inside the bitmap
+    assert(attach_shared_allocator(name) == NULL);
+    memcpy(fields, saved, sizeof(saved));
+    fields[4] = 0; // bitmap_offset over the header
+    assert(attach_shared_allocator(name) == NULL);
+    memcpy(fields, saved, sizeof(saved));
+
+    BlockAllocator* other = attach_shared_allocator(name);
+    assert(other != NULL);
+    free_allocator(other);
+    assert(unlink_shared_allocator(name) == 0);
+    free_allocator(alloc);
+}
+
+// Test scopes are refused on shared pools
+TEST(mark_rollback_shared_refused) {
+    ENABLE_ASSERT();
+    NORMAL_MALLOC();
+    char name[64];
+    snprintf(name, sizeof(name), "/block_allocator_scope_%d", (int)getpid());
+    unlink_shared_allocator(name);
+    BlockAllocator* alloc = create_shared_allocator(name, BLOCK_SIZE, BLOCK_SIZE * 16);
+    assert(alloc != NULL);
+
+    DISABLE_ASSERT();
+    CLEAR_ASSERT_FAILURES();
+    AllocMark mark = alloc_mark(alloc);
+    assert(ASSERT_FAILURES(1));
+    assert(mark == ALLOC_MARK_NONE);
+    assert(alloc->scope_depth == 0);
+    void* ptr = BLOCK_ALLOC(alloc);
+    assert(ptr != NULL);
+    assert(alloc->scope_log_len == 0); // Nothing logged
+    alloc_rollback(alloc, mark);
+    assert(is_allocated(alloc, ptr)); // Rollback left the block alone
+    alloc_commit(alloc, mark);
+    assert(ASSERT_FAILURES(1)); // The sentinel itself is not misuse
+    alloc_rollback(alloc, 0);
+    assert(ASSERT_FAILURES(2));
+    assert(is_allocated(alloc, ptr));
+    ENABLE_ASSERT();
+    assert(alloc->scope_depth == 0);
+
+    BLOCK_FREE(alloc, ptr);
+    assert(unlink_shared_allocator(name) == 0);
+    free_allocator(alloc);
+}
+
+// Test colored placement pads power-of-two strides only
+TEST(colored_allocator) {
+    ENABLE_ASSERT();
+    NORMAL_MALLOC();
+    BlockAllocator* plain = init_allocator(BLOCK_SIZE, TOTAL_SIZE);
+    BlockAllocator* colored = init_colored_allocator(BLOCK_SIZE, TOTAL_SIZE);
+    assert(plain != NULL && colored != NULL);
+    assert(colored->total_blocks == plain->total_blocks);
+    size_t stride = plain->block_size;
+    if (stride > BLOCK_CACHE_LINE_SIZE && (stride & (stride - 1)) == 0) {
+        assert(colored->block_size == stride + BLOCK_CACHE_LINE_SIZE);
+    } else {
+        assert(colored->block_size == stride);
+    }
+    free_allocator(plain);
+
+    // Find a client size whose stride is a power of two in this configuration
+    size_t overhead = colored->block_size - colored->block_data_size;
+    free_allocator(colored);
+    colored = init_colored_allocator(4096 - overhead, (4096 - overhead) * 16);
+    assert(colored != NULL);
+    assert(colored->block_size == 4096 + BLOCK_CACHE_LINE_SIZE);
+    assert(colored->total_size == 16 * colored->block_size);
+
+    void* ptrs[16];
+    for (int i = 0; i < 16; i++) {
+        ptrs[i] = BLOCK_ALLOC(colored);
+        assert(ptrs[i] != NULL);
+        assert(is_allocated(colored, ptrs[i]));
+        memset(ptrs[i], 0xEE, colored->block_data_size);
+        // Consecutive blocks start one cache line further into a page
+        size_t offset = (uint8_t*)ptrs[i] - colored->memory - colored->data_offset;
+        assert(offset % 4096 == ((size_t)i * BLOCK_CACHE_LINE_SIZE) % 4096);
+    }
+    assert(BLOCK_ALLOC(colored) == NULL);
+    for (int i = 0; i < 16; i++) {
+        BLOCK_FREE(colored, ptrs[i]);
+        assert(!is_block_allocated(colored, i));
+    }
+    free_allocator(colored);
+}
+
+// Test locality hinted allocation searches outward from the hint
+TEST(alloc_block_near) {
+    ENABLE_ASSERT();
+    NORMAL_MALLOC();
+    BlockAllocator* alloc = init_allocator(BLOCK_SIZE, BLOCK_SIZE * 64);
+    assert(alloc != NULL);
+    void* ptrs[64];
+    for (int i = 0; i < 64; i++) ptrs[i] = BLOCK_ALLOC(alloc);
+    BLOCK_FREE(alloc, ptrs[2]);
+    BLOCK_FREE(alloc, ptrs[45]);
+    BLOCK_FREE(alloc, ptrs[47]);
+
+    // Both neighbours of the hint go before the lowest free block
+    void* first = BLOCK_ALLOC_NEAR(alloc, ptrs[46]);
+    void* second = BLOCK_ALLOC_NEAR(alloc, ptrs[46]);
+    assert((first == ptrs[45] && second == ptrs[47]) || (first == ptrs[47] && second == ptrs[45]));
+    assert(BLOCK_ALLOC_NEAR(alloc, ptrs[46]) == ptrs[2]); // Same bitmap cache line
+    assert(BLOCK_ALLOC_NEAR(alloc, ptrs[46]) == NULL);
+#if ENABLE_DEBUG_HEADER
+    DebugHeader* header = (DebugHeader*)((uint8_t*)first - alloc->data_offset);
+    assert(header->file != NULL && header->line > 0);
+#endif
+
+    // Hints outside the pool fall back to first fit
+    BLOCK_FREE(alloc, ptrs[10]);
+    BLOCK_FREE(alloc, ptrs[20]);
+    assert(BLOCK_ALLOC_NEAR(alloc, NULL) == ptrs[10]);
+    assert(BLOCK_ALLOC_NEAR(alloc, (void*)0x1) == ptrs[20]);
+    assert(BLOCK_ALLOC_NEAR(NULL, ptrs[0]) == NULL);
+    for (int i = 0; i < 64; i++) BLOCK_FREE(alloc, ptrs[i]);
+    free_allocator(alloc);
+
+    // With nothing free near the hint, the first fit is used
+    alloc = init_allocator(8, 8 * 1024);
+    assert(alloc != NULL);
+    void** many = malloc(sizeof(void*) * 1024);
+    for (int i = 0; i < 1024; i++) many[i] = BLOCK_ALLOC(alloc);
+    BLOCK_FREE(alloc, many[5]);
+    BLOCK_FREE(alloc, many[700]);
+    assert(BLOCK_ALLOC_NEAR(alloc, many[1000]) == many[700]); // Same bitmap cache line
+    assert(BLOCK_ALLOC_NEAR(alloc, many[1000]) == many[5]);
+    for (int i = 0; i < 1024; i++) BLOCK_FREE(alloc, many[i]);
+    free(many);
+    free_allocator(alloc);
+}
+
+// Test the scan counter reports the bitmap bytes each search examined
+TEST(scanned_bytes) {
+    ENABLE_ASSERT();
+    NORMAL_MALLOC();
+    BlockAllocator* alloc = init_allocator(8, 8 * 1024);
+    assert(alloc != NULL);
+    assert(alloc->scanned_bytes == 0);
+    void** many = malloc(sizeof(void*) * 1024);
+    for (int i = 0; i < 9; i++) many[i] = BLOCK_ALLOC(alloc);
+    assert(alloc->scanned_bytes == 8 * 1 + 2); // The ninth block is in the second byte
+    for (int i = 9; i < 1024; i++) many[i] = BLOCK_ALLOC(alloc);
+
+    alloc->scanned_bytes = 0;
+    BLOCK_FREE(alloc, many[1000]);
+    assert(BLOCK_ALLOC_NEAR(alloc, many[999]) == many[1000]);
+    assert(alloc->scanned_bytes == 2); // Blocks 998 to 1000 span two bytes
+    alloc->scanned_bytes = 0;
+    BLOCK_FREE(alloc, many[1000]);
+    assert(BLOCK_ALLOC(alloc) == many[1000]);
+    assert(alloc->scanned_bytes == 1000 / 8 + 1);
+    alloc->scanned_bytes = 0;
+    assert(BLOCK_ALLOC(alloc) == NULL);
+    assert(alloc->scanned_bytes == 1024 / 8);
+    for (int i = 0; i < 1024; i++) BLOCK_FREE(alloc, many[i]);
+    free(many);
+    free_allocator(alloc);
+}
+
 int main() {
     printf("Starting unit tests...\n");
     RUN_TEST(init_allocator);
@@ -410,6 +1048,26 @@ int main() {
     RUN_TEST(bitmap_operations);
     RUN_TEST(mixed_allocation);
     RUN_TEST(nearly_full_allocator);
+    RUN_TEST(alloc_block_near);
+    RUN_TEST(scanned_bytes);
+    RUN_TEST(object_cache_preserves_state);
+    RUN_TEST(object_cache_reclaim);
+#ifdef TEST_MALLOC
+    RUN_TEST(object_cache_malloc_failure);
+#endif
+    RUN_TEST(compact_allocator);
+    RUN_TEST(compact_object_allocator);
+    RUN_TEST(mark_rollback);
+    RUN_TEST(mark_rollback_shared_refused);
+    RUN_TEST(colored_allocator);
+    RUN_TEST(trace_recording);
+    RUN_TEST(shared_pool_ipc);
+    RUN_TEST(shared_pool_detach_skips_stomp_scan);
+    RUN_TEST(shared_pool_attach_validates_header);
+#if ENABLE_DEBUG_HEADER
+    RUN_TEST(profiler_callsites);
+    RUN_TEST(profiler_sampling);
+#endif
     printf("All %d tests passed!\n", tests_passed);
     return 0;
 }
@@ -0,0 +1,134 @@
+#include <cassert>
+#include <cstdio>
+#include <list>
+#include <map>
+#include <memory_resource>
+#include <unordered_map>
+#include <vector>
+#include "block_allocator.hpp"
+
+using block_allocator::BlockMemoryResource;
+using block_allocator::BlockStlAllocator;
+using block_allocator::probe_node_size;
+
+// Test framework macros
+#define TEST(name) void test_##name(void)
+#define RUN_TEST(name) do { printf("Running %s...\n", #name); test_##name(); tests_passed++; } while(0)
+static int tests_passed = 0;
+
+// Resource that counts what reaches it, used as the upstream
+class CountingResource : public std::pmr::memory_resource {
+public:
+    int allocations = 0;
+    int deallocations = 0;
+private:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+        allocations++;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override {
+        deallocations++;
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+};
+
+// Test node requests come from the pool and the rest go upstream
+TEST(resource_routing) {
+    CountingResource upstream;
+    {
+        BlockMemoryResource resource(32, 4, &upstream);
+        void* small = resource.allocate(24, 8);
+        assert(resource.owns(small));
+        assert(upstream.allocations == 0);
+
+        void* large = resource.allocate(64, 8);
+        assert(!resource.owns(large));
+        assert(upstream.allocations == 1);
+
+        void* aligned = resource.allocate(16, 4096); // Stricter than the pool guarantees
+        assert(!resource.owns(aligned));
+        assert(upstream.allocations == 2);
+
+        void* more[3];
+        for (int i = 0; i < 3; i++) more[i] = resource.allocate(32, 8);
+        void* overflow = resource.allocate(32, 8); // Pool is full
+        assert(!resource.owns(overflow));
+        assert(upstream.allocations == 3);
+
+        resource.deallocate(small, 24, 8);
+        void* reused = resource.allocate(32, 8); // Freed nodes are handed out first
+        assert(reused == small);
+        assert(upstream.allocations == 3);
+        resource.deallocate(reused, 32, 8);
+        resource.deallocate(large, 64, 8);
+        resource.deallocate(aligned, 16, 4096);
+        resource.deallocate(overflow, 32, 8);
+        for (int i = 0; i < 3; i++) resource.deallocate(more[i], 32, 8);
+        assert(upstream.deallocations == 3);
+        assert(resource.is_equal(resource));
+    }
+}
+
+// Test pmr node containers draw every node from the pool
+TEST(pmr_containers) {
+    std::size_t list_node = probe_node_size<std::pmr::list<int>>(
+        [](auto& l, int i) { l.push_back(i); });
+    std::size_t map_node = probe_node_size<std::pmr::map<int, int>>(
+        [](auto& m, int i) { m.emplace(i, i); });
+    assert(list_node >= sizeof(int) + 2 * sizeof(void*));
+    assert(map_node > list_node);
+
+    CountingResource upstream;
+    {
+        BlockMemoryResource resource(map_node, 1000, &upstream);
+        std::pmr::list<int> list(&resource);
+        std::pmr::map<int, int> map(&resource);
+        for (int i = 0; i < 400; i++) {
+            list.push_back(i);
+            map.emplace(i, i * 2);
+        }
+        assert(upstream.allocations == 0);
+        long sum = 0;
+        for (int v : list) sum += v;
+        assert(sum == 400 * 399 / 2);
+        assert(map[123] == 246);
+    }
+    assert(upstream.allocations == upstream.deallocations);
+}
+
+// Test the classic allocator template with rebinding containers
+TEST(stl_allocator) {
+    CountingResource upstream;
+    {
+        BlockMemoryResource resource(64, 1000, &upstream);
+        BlockStlAllocator<int> alloc(&resource);
+        std::list<int, BlockStlAllocator<int>> list(alloc);
+        std::unordered_map<int, int, std::hash<int>, std::equal_to<int>,
+                           BlockStlAllocator<std::pair<const int, int>>> map(0, std::hash<int>(),
+                                                                            std::equal_to<int>(), alloc);
+        for (int i = 0; i < 100; i++) {
+            list.push_back(i);
+            map[i] = i;
+        }
+        assert(list.size() == 100 && map.size() == 100);
+        assert(upstream.allocations > 0); // Bucket arrays are too big for the pool
+        assert(alloc == BlockStlAllocator<long>(&resource));
+
+        std::vector<int, BlockStlAllocator<int>> vec(alloc);
+        vec.resize(1000); // Array allocations go upstream
+        assert(!resource.owns(vec.data()));
+    }
+    assert(upstream.allocations == upstream.deallocations);
+}
+
+int main() {
+    printf("Starting pmr adapter tests...\n");
+    RUN_TEST(resource_routing);
+    RUN_TEST(pmr_containers);
+    RUN_TEST(stl_allocator);
+    printf("All %d tests passed!\n", tests_passed);
+    return 0;
+}